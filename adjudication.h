@@ -0,0 +1,148 @@
+#pragma once
+
+#include "position.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ostream>
+
+// Rules that end a headless game before the board does. Every rule is off at zero.
+struct AdjudicationConfig {
+    // A material lead of this many men, a queen counting QUEEN_VALUE, held for marginPlies quiet
+    // plies in a row wins.
+    int materialMargin = 0;
+    int marginPlies = 10;
+    // An evaluation for one side of at least this, in (0, 1), held for evalPlies plies in a row wins.
+    float evalThreshold = 0;
+    int evalPlies = 6;
+    // A game this long is a draw.
+    int maxPlies = 0;
+
+    static constexpr int QUEEN_VALUE = 3;
+};
+
+enum class Adjudication : std::uint8_t {
+    // The game ended on the board.
+    None,
+    Material,
+    Evaluation,
+    PlyCap,
+};
+
+// Follows one game. Judge is called with every position, the result is as PlayGame returns it.
+class Adjudicator {
+public:
+    // The expected result for the whites in [-1, 1], needed for the evaluation rule.
+    using Evaluator = std::function<float(const Position&)>;
+
+    explicit Adjudicator(AdjudicationConfig config, Evaluator evaluate = {})
+        : config_(config), evaluate_(std::move(evaluate)) {
+    }
+
+    std::optional<int> Judge(const Position& position) {
+        ++plies_;
+        // Mid-exchange the count is off by the pieces about to be taken, so only quiet positions
+        // count.
+        if (config_.materialMargin > 0 && !HasCapture(position)) {
+            auto lead = Material(position.whites, position.queens) - Material(position.blacks, position.queens);
+            auto side = lead >= config_.materialMargin ? 1 : lead <= -config_.materialMargin ? -1 : 0;
+            if (Held(materialStreak_, side) >= config_.marginPlies) {
+                return Decide(Adjudication::Material, side);
+            }
+        }
+        if (config_.evalThreshold > 0 && evaluate_) {
+            auto value = evaluate_(position);
+            auto side = value >= config_.evalThreshold ? 1 : value <= -config_.evalThreshold ? -1 : 0;
+            if (Held(evalStreak_, side) >= config_.evalPlies) {
+                return Decide(Adjudication::Evaluation, side);
+            }
+        }
+        if (config_.maxPlies > 0 && plies_ >= config_.maxPlies) {
+            return Decide(Adjudication::PlyCap, 0);
+        }
+        return std::nullopt;
+    }
+
+    Adjudication Reason() const {
+        return reason_;
+    }
+
+    // Positions judged so far, the length of the game once it is over.
+    int Plies() const {
+        return plies_;
+    }
+
+private:
+    static int Material(std::uint32_t pieces, std::uint32_t queens) {
+        return std::popcount(pieces & ~queens) + AdjudicationConfig::QUEEN_VALUE * std::popcount(pieces & queens);
+    }
+
+    static bool HasCapture(const Position& position) {
+        auto moves = position.Moves();
+        return !moves.Empty() && moves[0].IsCapture();
+    }
+
+    struct Streak {
+        int side = 0;
+        int plies = 0;
+    };
+
+    // Plies in a row the side has been ahead, 0 if nobody is.
+    static int Held(Streak& streak, int side) {
+        streak.plies = side != 0 && side == streak.side ? streak.plies + 1 : 1;
+        streak.side = side;
+        return side == 0 ? 0 : streak.plies;
+    }
+
+    int Decide(Adjudication reason, int side) {
+        reason_ = reason;
+        return side > 0 ? 0 : side < 0 ? 1 : 2;
+    }
+
+    AdjudicationConfig config_;
+    Evaluator evaluate_;
+    Streak materialStreak_;
+    Streak evalStreak_;
+    int plies_ = 0;
+    Adjudication reason_ = Adjudication::None;
+};
+
+// Totals over many games, updated from any thread.
+struct AdjudicationStats {
+    std::atomic<std::uint64_t> games = 0;
+    std::atomic<std::uint64_t> plies = 0;
+    std::atomic<std::uint64_t> byMaterial = 0;
+    std::atomic<std::uint64_t> byEvaluation = 0;
+    std::atomic<std::uint64_t> byPlyCap = 0;
+
+    void Add(Adjudication reason, int plies) {
+        games.fetch_add(1, std::memory_order_relaxed);
+        this->plies.fetch_add(plies, std::memory_order_relaxed);
+        if (reason == Adjudication::Material) {
+            byMaterial.fetch_add(1, std::memory_order_relaxed);
+        } else if (reason == Adjudication::Evaluation) {
+            byEvaluation.fetch_add(1, std::memory_order_relaxed);
+        } else if (reason == Adjudication::PlyCap) {
+            byPlyCap.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void Reset() {
+        games = 0;
+        plies = 0;
+        byMaterial = 0;
+        byEvaluation = 0;
+        byPlyCap = 0;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const AdjudicationStats& stats) {
+        auto games = std::max<std::uint64_t>(stats.games, 1);
+        return os << stats.games << " games of " << static_cast<double>(stats.plies) / games
+                  << " plies on average, adjudicated " << stats.byMaterial << " by material, "
+                  << stats.byEvaluation << " by evaluation, " << stats.byPlyCap << " by the ply cap";
+    }
+};
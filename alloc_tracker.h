@@ -0,0 +1,255 @@
+#pragma once
+
+#include "profiler.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// Counts heap allocations. Built with CHECKERS_ALLOC_TRACKING (the cmake option of the same name)
+// this header replaces the global operator new and delete, so include it from exactly one
+// translation unit. ALLOC_SCOPE attributes the allocations its thread makes while the scope is
+// alive, ALLOC_SCOPE_PROCESS those of all threads, e.g. of a training epoch spread over a pool.
+// Nested scopes all see the same allocation. Without the option both macros compile to nothing.
+namespace alloc_tracker {
+
+#ifdef CHECKERS_ALLOC_TRACKING
+inline constexpr bool ENABLED = true;
+#else
+inline constexpr bool ENABLED = false;
+#endif
+
+struct Counts {
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t frees = 0;
+};
+
+// Plain data, so the hooks never run a thread_local initializer.
+inline thread_local Counts threadCounts;
+// Set while the tracker allocates for itself.
+inline thread_local bool suppressed = false;
+
+inline std::atomic<std::uint64_t> processAllocations = 0;
+inline std::atomic<std::uint64_t> processBytes = 0;
+inline std::atomic<std::uint64_t> processFrees = 0;
+
+inline void OnAllocate(std::size_t size) {
+    if (suppressed) {
+        return;
+    }
+    ++threadCounts.allocations;
+    threadCounts.bytes += size;
+    processAllocations.fetch_add(1, std::memory_order_relaxed);
+    processBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+inline void OnFree() {
+    if (suppressed) {
+        return;
+    }
+    ++threadCounts.frees;
+    processFrees.fetch_add(1, std::memory_order_relaxed);
+}
+
+struct Totals {
+    std::uint64_t scopes = 0;
+    Counts counts;
+
+    void Add(const Totals& other) {
+        scopes += other.scopes;
+        counts.allocations += other.counts.allocations;
+        counts.bytes += other.counts.bytes;
+        counts.frees += other.counts.frees;
+    }
+};
+
+using TotalsByScope = std::unordered_map<const char*, Totals>;
+
+// Scopes add to the totals of their thread, which are merged under the lock only when the thread
+// exits or the totals are exported.
+class Registry {
+public:
+    static Registry& Get() {
+        static Registry registry;
+        return registry;
+    }
+
+    void Record(const char* name, const Counts& counts) {
+        suppressed = true;
+        thread_local ThreadTotals local(*this);
+        local.totals[name].Add({1, counts});
+        suppressed = false;
+    }
+
+    // Reads the totals of live threads as they are, so call it while no thread closes a scope, as
+    // the profiler's exports.
+    std::vector<std::pair<const char*, Totals>> Snapshot() const {
+        std::unique_lock lock(mutex_);
+        auto merged = exited_;
+        for (const auto* totals : live_) {
+            Merge(merged, *totals);
+        }
+        return {merged.begin(), merged.end()};
+    }
+
+private:
+    struct ThreadTotals {
+        explicit ThreadTotals(Registry& registry) : registry(registry) {
+            std::unique_lock lock(registry.mutex_);
+            registry.live_.push_back(&totals);
+        }
+
+        ~ThreadTotals() {
+            suppressed = true;
+            std::unique_lock lock(registry.mutex_);
+            Merge(registry.exited_, totals);
+            std::erase(registry.live_, &totals);
+            totals.clear();
+        }
+
+        Registry& registry;
+        TotalsByScope totals;
+    };
+
+    static void Merge(TotalsByScope& into, const TotalsByScope& from) {
+        for (const auto& [name, totals] : from) {
+            into[name].Add(totals);
+        }
+    }
+
+    mutable std::mutex mutex_;
+    TotalsByScope exited_;
+    std::vector<const TotalsByScope*> live_;
+};
+
+class Scope {
+public:
+    Scope(const char* name, bool processWide) : name_(name), processWide_(processWide), start_(Now()) {
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    ~Scope() {
+        auto end = Now();
+        Registry::Get().Record(name_, {
+            end.allocations - start_.allocations,
+            end.bytes - start_.bytes,
+            end.frees - start_.frees});
+    }
+
+private:
+    Counts Now() const {
+        if (!processWide_) {
+            return threadCounts;
+        }
+        return {processAllocations.load(std::memory_order_relaxed), processBytes.load(std::memory_order_relaxed),
+                processFrees.load(std::memory_order_relaxed)};
+    }
+
+    const char* name_;
+    bool processWide_;
+    Counts start_;
+};
+
+// Averages per scope instance, e.g. allocations per generated move or per game.
+inline void WriteSummary(std::ostream& os) {
+    os << std::left << std::setw(32) << "scope" << std::right << std::setw(12) << "count"
+       << std::setw(14) << "allocs/scope" << std::setw(14) << "bytes/scope" << std::setw(14) << "frees/scope"
+       << '\n' << std::fixed << std::setprecision(1);
+    for (const auto& [name, totals] : Registry::Get().Snapshot()) {
+        double scopes = totals.scopes;
+        os << std::left << std::setw(32) << name << std::right << std::setw(12) << totals.scopes
+           << std::setw(14) << totals.counts.allocations / scopes << std::setw(14) << totals.counts.bytes / scopes
+           << std::setw(14) << totals.counts.frees / scopes << '\n';
+    }
+    os << "process total: " << processAllocations << " allocations, " << processBytes << " bytes, "
+       << processFrees << " frees\n";
+}
+
+}  // namespace alloc_tracker
+
+#ifdef CHECKERS_ALLOC_TRACKING
+
+#define ALLOC_SCOPE(name) ::alloc_tracker::Scope PROFILE_CONCAT(allocScope, __LINE__)(name, false)
+#define ALLOC_SCOPE_PROCESS(name) ::alloc_tracker::Scope PROFILE_CONCAT(allocScope, __LINE__)(name, true)
+
+void* operator new(std::size_t size) {
+    alloc_tracker::OnAllocate(size);
+    if (auto* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    alloc_tracker::OnAllocate(size);
+    auto align = static_cast<std::size_t>(alignment);
+    if (auto* ptr = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+// The replacement new above is malloc, GCC cannot see that through the inlined call.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void operator delete(void* ptr) noexcept {
+    if (ptr) {
+        alloc_tracker::OnFree();
+    }
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+    operator delete(ptr);
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+#define ALLOC_SCOPE(name) ((void)0)
+#define ALLOC_SCOPE_PROCESS(name) ((void)0)
+
+#endif
@@ -0,0 +1,227 @@
+// Microbenchmarks of the engine's hot paths, built as checkers_bench. Prints one JSON object per
+// case, see benchmark.h. Usage: checkers_bench [filter]
+#include "main.cpp"
+
+#include "benchmark.h"
+
+struct EngineBenchmarks {
+    struct Snapshot {
+        std::unique_ptr<GameManager> game;
+        int ply = 0;
+    };
+
+    explicit EngineBenchmarks(benchmark::Config config) : runner(std::move(config)) {
+    }
+
+    static constexpr int NUM_GAMES = 4;
+    static constexpr double EXPLORATION = 0.3;
+
+    static std::string PhaseOf(int ply) {
+        if (ply < 10) {
+            return "opening";
+        }
+        if (ply < 30) {
+            return "middlegame";
+        }
+        return "endgame";
+    }
+
+    // Starts of turns from games between exploring bots, grouped by phase.
+    std::map<std::string, std::vector<Snapshot>> CollectPositions() {
+        std::map<std::string, std::vector<Snapshot>> positions;
+        for (int i = 0; i < NUM_GAMES; ++i) {
+            auto white = std::make_shared<AiBot>(std::make_shared<ValueNet>(2 * i + 1));
+            auto black = std::make_shared<AiBot>(std::make_shared<ValueNet>(2 * i + 2));
+            white->SetExploration(EXPLORATION, 2 * i + 1);
+            black->SetExploration(EXPLORATION, 2 * i + 2);
+            GameManager game(8, 8, renderer);
+            game.InitBoard();
+            game.Start();
+            Controller controller(game, white, black);
+            int ply = 0;
+            PlayGame(game, controller, [&](const Position&, bool) {
+                positions[PhaseOf(ply)].push_back({std::make_unique<GameManager>(game, renderer), ply});
+                ++ply;
+            });
+        }
+        return positions;
+    }
+
+    std::unique_ptr<GameManager> Copy(const Snapshot& snapshot) {
+        return std::make_unique<GameManager>(*snapshot.game, renderer);
+    }
+
+    // CalculateMoves on positions with their move trees cleared outside of the timed region.
+    void CalculateMoves(const std::string& phase, const std::vector<Snapshot>& positions) {
+        size_t next = 0;
+        runner.RunWithSetup("GameManager::CalculateMoves/" + phase, [&](size_t n) {
+            std::vector<std::unique_ptr<GameManager>> games;
+            for (size_t i = 0; i < n; ++i) {
+                auto game = Copy(positions[next++ % positions.size()]);
+                for (auto pieceId : game->availablePieces_) {
+                    game->paths_.at(game->allPieces_.at(pieceId).cellId)->children.clear();
+                }
+                game->availablePieces_.clear();
+                games.push_back(std::move(game));
+            }
+            return games;
+        }, [](std::unique_ptr<GameManager>& game) {
+            game->CalculateMoves();
+        });
+    }
+
+    // The first legal move of the first movable piece, already selected.
+    void MakeMove(const std::string& phase, const std::vector<Snapshot>& positions) {
+        size_t next = 0;
+        runner.RunWithSetup("GameManager::MakeMove/" + phase, [&](size_t n) {
+            std::vector<std::pair<std::unique_ptr<GameManager>, int>> moves;
+            for (size_t i = 0; i < n; ++i) {
+                auto game = Copy(positions[next++ % positions.size()]);
+                game->PrepareClicks();
+                auto from = game->allPieces_.at(*game->availablePieces_.begin()).cellId;
+                game->ClickHighlightedPiece(from);
+                const auto& move = game->paths_.at(from)->children.front();
+                auto to = move->isEmptyCell ? move->cellId : move->children.front()->cellId;
+                moves.emplace_back(std::move(game), to);
+            }
+            return moves;
+        }, [](std::pair<std::unique_ptr<GameManager>, int>& move) {
+            try {
+                move.first->MakeMove(move.second);
+            } catch (const DrawError&) {
+            }
+        });
+    }
+
+    // A whole move of a bot, including the next turn's setup.
+    void ApplyMove(const std::string& phase, const std::vector<Snapshot>& positions) {
+        size_t next = 0;
+        runner.RunWithSetup("GameManager::ApplyMove/" + phase, [&](size_t n) {
+            std::vector<std::pair<std::unique_ptr<GameManager>, Move>> moves;
+            for (size_t i = 0; i < n; ++i) {
+                auto game = Copy(positions[next++ % positions.size()]);
+                auto move = game->GetPosition().Moves()[0];
+                moves.emplace_back(std::move(game), move);
+            }
+            return moves;
+        }, [](std::pair<std::unique_ptr<GameManager>, Move>& move) {
+            try {
+                move.first->ApplyMove(move.second);
+            } catch (const OutOfMovesError&) {
+            } catch (const DrawError&) {
+            }
+        });
+    }
+
+    // The value-type move generation that the bots use.
+    void PositionMoves(const std::string& phase, const std::vector<Snapshot>& positions) {
+        size_t next = 0;
+        runner.Run("Position::Moves/" + phase, [&]() {
+            benchmark::DoNotOptimize(positions[next++ % positions.size()].game->GetPosition().Moves().Size());
+        });
+    }
+
+    void CalcTurns(const std::string& name, AiBot& bot, const std::vector<Snapshot>& positions) {
+        size_t next = 0;
+        runner.Run("AiBot::CalcTurns/" + name, [&]() {
+            const auto& position = positions[next++ % positions.size()].game->GetPosition();
+            benchmark::DoNotOptimize(bot.CalcTurns(position).value);
+        });
+    }
+
+    // Positions follow each other through the games, so part of the tree is often kept as in play.
+    void MctsTurn(size_t numThreads) {
+        MctsConfig config;
+        config.playouts = 256;
+        config.numThreads = numThreads;
+        MctsBot bot(std::make_shared<ValueNet>(1), config);
+        size_t next = 0;
+        runner.Run("MctsBot::Turn/" + std::to_string(config.playouts) + "x" + std::to_string(numThreads), [&]() {
+            benchmark::DoNotOptimize(bot.Turn(all[next++ % all.size()].game->GetPosition()));
+        });
+    }
+
+    void Forward() {
+        BoardCodes codes = all.front().game->GetPosition().Encode();
+        auto valueNet = std::make_shared<ValueNet>(1);
+        runner.Run("ValueNet::Forward", [&]() {
+            benchmark::DoNotOptimize(valueNet->Forward(codes));
+        });
+
+        auto nn = CreateNeuralNetwork();
+        auto matrix = CreateMatrixFromData(ToInput(codes));
+        nn->AdjustShape(matrix);
+        runner.Run("Sequential::Forward", [&]() {
+            benchmark::DoNotOptimize(nn->Forward(matrix)[0]);
+        });
+    }
+
+    // Round trip of an empty task: queueing, waking a worker and waiting for completion.
+    void ThreadPoolLatency() {
+        std::vector<size_t> poolSizes = {1};
+        if (DefaultNumThreads() > 1) {
+            poolSizes.push_back(DefaultNumThreads());
+        }
+        for (auto numThreads : poolSizes) {
+            ThreadPool pool(numThreads);
+            runner.Run("ThreadPool::AddTask/" + std::to_string(numThreads), [&]() {
+                pool.AddTask([]() {})->Wait();
+            });
+        }
+    }
+
+    // One Controller click line.
+    void LineLoggerThroughput() {
+        std::ofstream devNull("/dev/null");
+        Logger logger("Game0", devNull);
+        int cellId = 0;
+        runner.Run("LineLogger", [&]() {
+            logger << "(whites," << cellId++ % 64 << ")";
+        });
+    }
+
+    void Run() {
+        auto positions = CollectPositions();
+        for (auto& [phase, group] : positions) {
+            for (auto& position : group) {
+                all.push_back({Copy(position), position.ply});
+            }
+        }
+        for (const auto& [phase, group] : positions) {
+            CalculateMoves(phase, group);
+            MakeMove(phase, group);
+            ApplyMove(phase, group);
+            PositionMoves(phase, group);
+        }
+
+        AiBot valueNetBot(std::make_shared<ValueNet>(1));
+        CalcTurns("ValueNet", valueNetBot, all);
+        // Warm after the first pass over the positions, so this is the cost of a hit.
+        AiBot cachedBot(std::make_shared<ValueNet>(1));
+        cachedBot.SetEvalCache(std::make_shared<EvalCache>(1 << 16), EvalCache::NewNetworkId());
+        CalcTurns("ValueNet+EvalCache", cachedBot, all);
+        AiBot sequentialBot(CreateNeuralNetwork());
+        CalcTurns("Sequential", sequentialBot, all);
+        MctsTurn(1);
+        if (DefaultNumThreads() > 1) {
+            MctsTurn(DefaultNumThreads());
+        }
+
+        Forward();
+        ThreadPoolLatency();
+        LineLoggerThroughput();
+    }
+
+    EmptyRenderer renderer;
+    benchmark::Runner runner;
+    std::vector<Snapshot> all;
+};
+
+int main(int argc, char** argv) {
+    Log() = Logger("bench", NullStream());
+    benchmark::Config config;
+    if (argc > 1) {
+        config.filter = argv[1];
+    }
+    EngineBenchmarks(std::move(config)).Run();
+}
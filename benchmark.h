@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Minimal microbenchmark harness. Every case is calibrated so one repetition takes at least
+// minRepetitionTime, warmed up, then timed for a fixed number of repetitions. Reports the median
+// time per operation and the median absolute deviation, which unlike mean and stddev are not
+// thrown off by the occasional preempted repetition.
+namespace benchmark {
+
+// Keeps the compiler from deleting a computation whose result is unused.
+template <class T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Config {
+    std::chrono::nanoseconds minRepetitionTime = std::chrono::milliseconds(10);
+    size_t warmupRepetitions = 3;
+    size_t repetitions = 15;
+    // Only cases whose name contains it run.
+    std::string filter;
+};
+
+struct Result {
+    std::string name;
+    size_t iterations = 0;
+    size_t repetitions = 0;
+    double medianNs = 0;
+    double madNs = 0;
+    double minNs = 0;
+};
+
+inline double Median(std::vector<double> values) {
+    auto middle = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), middle, values.end());
+    if (values.size() % 2 == 1) {
+        return *middle;
+    }
+    return (*middle + *std::max_element(values.begin(), middle)) / 2;
+}
+
+class Runner {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Runner(Config config, std::ostream& os = std::cout) : config_(std::move(config)), os_(os) {
+    }
+
+    // op() is one operation.
+    template <class Op>
+    void Run(const std::string& name, Op op) {
+        Measure<false>(name, [](size_t) { return std::vector<char>(); }, [&](char) { op(); });
+    }
+
+    // setup(n) prepares the inputs of n operations outside of the timed region, op(input) is one
+    // operation, for operations that consume their input.
+    template <class Setup, class Op>
+    void RunWithSetup(const std::string& name, Setup setup, Op op) {
+        Measure<true>(name, setup, op);
+    }
+
+private:
+    template <bool HAS_INPUTS, class Setup, class Op>
+    void Measure(const std::string& name, Setup setup, Op op) {
+        if (name.find(config_.filter) == std::string::npos) {
+            return;
+        }
+        auto timeBatch = [&](size_t iterations) {
+            auto inputs = setup(HAS_INPUTS ? iterations : 0);
+            auto start = Clock::now();
+            if constexpr (HAS_INPUTS) {
+                for (auto& input : inputs) {
+                    op(input);
+                }
+            } else {
+                for (size_t i = 0; i < iterations; ++i) {
+                    op(char());
+                }
+            }
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+        };
+
+        size_t iterations = 1;
+        while (timeBatch(iterations) < config_.minRepetitionTime) {
+            iterations *= 2;
+        }
+        for (size_t i = 0; i < config_.warmupRepetitions; ++i) {
+            timeBatch(iterations);
+        }
+        std::vector<double> perOp;
+        for (size_t i = 0; i < config_.repetitions; ++i) {
+            perOp.push_back(static_cast<double>(timeBatch(iterations).count()) / iterations);
+        }
+
+        Result result{name, iterations, perOp.size()};
+        result.medianNs = Median(perOp);
+        std::vector<double> deviations;
+        for (auto value : perOp) {
+            deviations.push_back(std::abs(value - result.medianNs));
+        }
+        result.madNs = Median(deviations);
+        result.minNs = *std::min_element(perOp.begin(), perOp.end());
+        Report(result);
+    }
+
+    // One JSON object per line.
+    void Report(const Result& result) {
+        os_ << "{\"name\":\"" << result.name << "\",\"iterations\":" << result.iterations
+            << ",\"repetitions\":" << result.repetitions << ",\"median_ns\":" << result.medianNs
+            << ",\"mad_ns\":" << result.madNs << ",\"min_ns\":" << result.minNs << "}" << std::endl;
+    }
+
+    Config config_;
+    std::ostream& os_;
+};
+
+}  // namespace benchmark
@@ -0,0 +1,340 @@
+#pragma once
+
+#include "position.h"
+#include "utils.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+// One position seen during self-play together with the final result of its game.
+struct TrainingRecord {
+    // Two CellCodes per byte, low nibble first.
+    std::array<std::uint8_t, INPUT_ROWS / 2> cells{};
+    // +1 whites won, -1 blacks won, 0 draw. The colours of the stored position, which are swapped
+    // for the canonical positions of the blacks' turns.
+    std::int8_t result = 0;
+    std::uint8_t whitesTurn = 0;
+    std::uint16_t ply = 0;
+
+    void Pack(const BoardCodes& codes) {
+        for (size_t i = 0; i < cells.size(); ++i) {
+            cells[i] = codes[2 * i] | (codes[2 * i + 1] << 4);
+        }
+    }
+
+    BoardCodes Unpack() const {
+        BoardCodes codes;
+        for (size_t i = 0; i < cells.size(); ++i) {
+            codes[2 * i] = cells[i] & 0xF;
+            codes[2 * i + 1] = cells[i] >> 4;
+        }
+        return codes;
+    }
+};
+
+static_assert(sizeof(TrainingRecord) == 20);
+
+// Dataset layout: dir/index lists "shard_NNNNNN.bin count" lines, each shard is a header followed
+// by fixed-size records. Shards are preallocated and only ever appended to.
+struct ShardHeader {
+    static constexpr std::uint32_t MAGIC = 0x534B4843;  // "CHKS"
+    static constexpr std::uint32_t VERSION = 1;
+
+    std::uint32_t magic = MAGIC;
+    std::uint32_t version = VERSION;
+    std::uint32_t recordSize = sizeof(TrainingRecord);
+    std::uint32_t reserved = 0;
+    std::uint64_t capacity = 0;
+    std::atomic<std::uint64_t> count = 0;
+    std::uint8_t padding[32] = {};
+};
+
+static_assert(sizeof(ShardHeader) == 64);
+
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    MappedFile(const std::string& path, size_t size, bool writable) {
+        fd_ = ::open(path.c_str(), writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        if (writable && ::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            ::close(fd_);
+            throw std::runtime_error("cannot grow " + path);
+        }
+        auto prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        data_ = ::mmap(nullptr, size, prot, MAP_SHARED, fd_, 0);
+        if (data_ == MAP_FAILED) {
+            ::close(fd_);
+            throw std::runtime_error("cannot mmap " + path);
+        }
+        size_ = size;
+    }
+
+    MappedFile(MappedFile&& rhs) noexcept
+        : fd_(std::exchange(rhs.fd_, -1)), data_(std::exchange(rhs.data_, nullptr)),
+          size_(std::exchange(rhs.size_, 0)) {
+    }
+
+    MappedFile& operator=(MappedFile&& rhs) noexcept {
+        std::swap(fd_, rhs.fd_);
+        std::swap(data_, rhs.data_);
+        std::swap(size_, rhs.size_);
+        return *this;
+    }
+
+    ~MappedFile() {
+        if (data_) {
+            ::munmap(data_, size_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    void* Data() const {
+        return data_;
+    }
+
+    void Sync() const {
+        ::msync(data_, size_, MS_ASYNC);
+    }
+
+    // Unmaps and closes the file, cut down to its first `size` bytes.
+    void CloseAt(size_t size) {
+        ::munmap(std::exchange(data_, nullptr), size_);
+        size_ = 0;
+        auto truncated = ::ftruncate(fd_, static_cast<off_t>(size)) == 0;
+        ::close(std::exchange(fd_, -1));
+        if (!truncated) {
+            throw std::runtime_error("cannot shrink a mapped file");
+        }
+    }
+
+private:
+    int fd_ = -1;
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+inline std::string ShardName(size_t shardId) {
+    std::stringstream ss;
+    ss << "shard_" << std::setw(6) << std::setfill('0') << shardId << ".bin";
+    return ss.str();
+}
+
+// Appends records to memory-mapped shards of a fixed capacity. Thread-safe.
+class DatasetWriter {
+public:
+    explicit DatasetWriter(std::filesystem::path dir, size_t recordsPerShard = 1 << 20)
+        : dir_(std::move(dir)), recordsPerShard_(recordsPerShard) {
+        std::filesystem::create_directories(dir_);
+        std::ifstream index(dir_ / "index");
+        std::string name;
+        size_t count;
+        while (index >> name >> count) {
+            counts_.push_back(count);
+        }
+        // Never reopen a shard for writing: a new run always starts a new shard.
+        OpenShard(counts_.size());
+    }
+
+    DatasetWriter(const DatasetWriter&) = delete;
+    DatasetWriter& operator=(const DatasetWriter&) = delete;
+
+    // Cuts the last shard down to its records, shards are preallocated to recordsPerShard.
+    ~DatasetWriter() {
+        std::unique_lock lock(mutex_);
+        auto count = Header().count.load();
+        Header().capacity = count;
+        shard_.Sync();
+        try {
+            shard_.CloseAt(sizeof(ShardHeader) + count * sizeof(TrainingRecord));
+        } catch (const std::exception& e) {
+            Log() << e.what();
+        }
+        WriteIndex();
+    }
+
+    void Append(std::span<const TrainingRecord> records) {
+        std::unique_lock lock(mutex_);
+        while (!records.empty()) {
+            auto& header = Header();
+            if (header.count == header.capacity) {
+                OpenShard(counts_.size());
+                continue;
+            }
+            auto toWrite = std::min<size_t>(records.size(), header.capacity - header.count);
+            std::memcpy(Records() + header.count, records.data(), toWrite * sizeof(TrainingRecord));
+            // Publish the count only after the records are in place.
+            header.count.store(header.count + toWrite, std::memory_order_release);
+            counts_.back() = header.count;
+            records = records.subspan(toWrite);
+        }
+    }
+
+    size_t Size() const {
+        std::unique_lock lock(mutex_);
+        size_t total = 0;
+        for (auto count : counts_) {
+            total += count;
+        }
+        return total;
+    }
+
+private:
+    ShardHeader& Header() {
+        return *static_cast<ShardHeader*>(shard_.Data());
+    }
+
+    TrainingRecord* Records() {
+        return reinterpret_cast<TrainingRecord*>(static_cast<char*>(shard_.Data()) + sizeof(ShardHeader));
+    }
+
+    void OpenShard(size_t shardId) {
+        if (shard_.Data()) {
+            shard_.Sync();
+        }
+        auto size = sizeof(ShardHeader) + recordsPerShard_ * sizeof(TrainingRecord);
+        shard_ = MappedFile(dir_ / ShardName(shardId), size, true);
+        new (shard_.Data()) ShardHeader();
+        Header().capacity = recordsPerShard_;
+        counts_.push_back(0);
+        WriteIndex();
+    }
+
+    void WriteIndex() const {
+        auto tmp = dir_ / "index.tmp";
+        {
+            std::ofstream index(tmp);
+            for (size_t i = 0; i < counts_.size(); ++i) {
+                index << ShardName(i) << ' ' << counts_[i] << '\n';
+            }
+        }
+        std::filesystem::rename(tmp, dir_ / "index");
+    }
+
+    std::filesystem::path dir_;
+    size_t recordsPerShard_;
+    MappedFile shard_;
+    std::vector<size_t> counts_;
+    mutable std::mutex mutex_;
+};
+
+// Read-only view over all shards listed in the index. Records are never copied.
+class DatasetReader {
+public:
+    explicit DatasetReader(const std::filesystem::path& dir) {
+        std::ifstream index(dir / "index");
+        if (!index) {
+            throw std::runtime_error("cannot open index in " + dir.string());
+        }
+        std::string name;
+        size_t count;
+        while (index >> name >> count) {
+            auto path = dir / name;
+            auto size = std::filesystem::file_size(path);
+            auto& shard = shards_.emplace_back(MappedFile(path, size, false));
+            const auto& header = *static_cast<const ShardHeader*>(shard.Data());
+            if (header.magic != ShardHeader::MAGIC || header.recordSize != sizeof(TrainingRecord)) {
+                throw std::runtime_error("bad shard " + path.string());
+            }
+            // The index lags behind a running writer, the header count never runs ahead of the data.
+            count = header.count.load(std::memory_order_acquire);
+            records_.emplace_back(reinterpret_cast<const TrainingRecord*>(
+                static_cast<const char*>(shard.Data()) + sizeof(ShardHeader)), count);
+            size_ += count;
+            offsets_.push_back(size_);
+        }
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    const TrainingRecord& operator[](size_t index) const {
+        auto shard = std::upper_bound(offsets_.begin(), offsets_.end(), index) - offsets_.begin();
+        auto begin = shard == 0 ? 0 : offsets_[shard - 1];
+        return records_[shard][index - begin];
+    }
+
+    template <class Rng>
+    void Sample(size_t batchSize, Rng& rng, std::vector<const TrainingRecord*>& batch) const {
+        batch.clear();
+        if (size_ == 0) {
+            return;
+        }
+        std::uniform_int_distribution<size_t> dist(0, size_ - 1);
+        for (size_t i = 0; i < batchSize; ++i) {
+            batch.push_back(&(*this)[dist(rng)]);
+        }
+    }
+
+private:
+    std::vector<MappedFile> shards_;
+    std::vector<std::span<const TrainingRecord>> records_;
+    std::vector<size_t> offsets_;
+    size_t size_ = 0;
+};
+
+// Collects the positions of one game and flushes them with the result once it is known. With
+// `keep` the finished records also stay for TakeRecords, e.g. to send them over the network. With
+// `canonical` it stores Position::Canonical, so every record has the whites to move.
+class GameRecorder {
+public:
+    explicit GameRecorder(DatasetWriter* writer, bool keep = false, bool canonical = false)
+        : writer_(writer), keep_(keep), canonical_(canonical) {
+    }
+
+    void Record(const Position& position) {
+        if (!writer_ && !keep_) {
+            return;
+        }
+        auto stored = canonical_ ? position.Canonical() : position;
+        auto& record = records_.emplace_back();
+        record.Pack(stored.Encode());
+        record.whitesTurn = stored.whitesTurn;
+        record.ply = records_.size() - 1;
+        flipped_.push_back(stored.whitesTurn != position.whitesTurn);
+    }
+
+    void Finish(std::int8_t result) {
+        for (size_t i = 0; i < records_.size(); ++i) {
+            records_[i].result = flipped_[i] ? -result : result;
+        }
+        flipped_.clear();
+        if (writer_) {
+            writer_->Append(records_);
+        }
+        if (!keep_) {
+            records_.clear();
+        }
+    }
+
+    std::vector<TrainingRecord> TakeRecords() {
+        return std::move(records_);
+    }
+
+private:
+    DatasetWriter* writer_;
+    bool keep_;
+    bool canonical_;
+    std::vector<bool> flipped_;
+    std::vector<TrainingRecord> records_;
+};
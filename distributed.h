@@ -0,0 +1,623 @@
+#pragma once
+
+#include "adjudication.h"
+#include "dataset.h"
+#include "genome.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Self-play spread over processes: a Coordinator hands out games to Workers that connect to it
+// over a Unix socket ("unix:/tmp/checkers.sock") or TCP ("host:port", an empty host listens on
+// all interfaces and connects to localhost). Workers can come and go between and during batches,
+// the games of a worker that disconnects are handed to the others.
+//
+// Messages are a Frame followed by its payload in the byte order of the machines, which are
+// expected to be alike. Networks are sent once per worker and then referred to by id.
+namespace distributed {
+
+inline constexpr std::uint32_t PROTOCOL_VERSION = 3;
+
+enum class MessageType : std::uint32_t {
+    // Worker: protocol version.
+    Hello,
+    // Coordinator: id, then the parameters of the network.
+    Net,
+    // Coordinator: ids the worker can drop from its cache.
+    Forget,
+    // Coordinator: a GameAssignment.
+    Game,
+    // Worker: tag, result and the training records of the game.
+    Result,
+    // Coordinator: no more games, the worker exits.
+    Bye,
+};
+
+struct Frame {
+    MessageType type;
+    std::uint32_t size;
+};
+
+// One game between two genomes, the mutation is the same for both.
+struct GameAssignment {
+    Genome white;
+    Genome black;
+    Mutation mutation;
+    // For the logs of the worker.
+    std::uint32_t gameInd = 0;
+    // Whether the worker sends back the positions of the game.
+    bool record = false;
+    // See AiBot::SetCanonical.
+    bool canonical = false;
+    AdjudicationConfig adjudication;
+};
+
+struct GameResult {
+    // As PlayGame returns it: 0 whites won, 1 blacks won, 2 draw.
+    int win = 2;
+    Adjudication adjudication = Adjudication::None;
+    int plies = 0;
+    std::vector<TrainingRecord> records;
+};
+
+class Writer {
+public:
+    template <class T>
+    Writer& Put(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return Put(std::as_bytes(std::span(&value, 1)));
+    }
+
+    Writer& Put(std::span<const std::byte> bytes) {
+        data_.insert(data_.end(), bytes.begin(), bytes.end());
+        return *this;
+    }
+
+    std::span<const std::byte> Data() const {
+        return data_;
+    }
+
+private:
+    std::vector<std::byte> data_;
+};
+
+class Reader {
+public:
+    explicit Reader(std::span<const std::byte> data) : data_(data) {
+    }
+
+    template <class T>
+    T Get() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        std::memcpy(&value, Take(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+
+    std::span<const std::byte> Take(size_t size) {
+        if (size > data_.size()) {
+            throw std::runtime_error("truncated message");
+        }
+        auto bytes = data_.first(size);
+        data_ = data_.subspan(size);
+        return bytes;
+    }
+
+private:
+    std::span<const std::byte> data_;
+};
+
+struct Message {
+    MessageType type;
+    std::vector<std::byte> payload;
+};
+
+class Socket {
+public:
+    Socket() = default;
+
+    explicit Socket(int fd) : fd_(fd) {
+    }
+
+    Socket(Socket&& rhs) noexcept : fd_(std::exchange(rhs.fd_, -1)) {
+    }
+
+    Socket& operator=(Socket&& rhs) noexcept {
+        std::swap(fd_, rhs.fd_);
+        return *this;
+    }
+
+    ~Socket() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    int Fd() const {
+        return fd_;
+    }
+
+    void Send(MessageType type, std::span<const std::byte> payload = {}) {
+        Frame frame{type, static_cast<std::uint32_t>(payload.size())};
+        SendAll(std::as_bytes(std::span(&frame, 1)));
+        SendAll(payload);
+    }
+
+    // Blocks until a whole message is in, nullopt once the peer closed the connection.
+    std::optional<Message> Receive() {
+        Frame frame;
+        if (!ReceiveAll(std::as_writable_bytes(std::span(&frame, 1)))) {
+            return std::nullopt;
+        }
+        Message message{frame.type, std::vector<std::byte>(frame.size)};
+        if (!ReceiveAll(message.payload)) {
+            throw std::runtime_error("connection closed mid-message");
+        }
+        return message;
+    }
+
+private:
+    void SendAll(std::span<const std::byte> bytes) {
+        while (!bytes.empty()) {
+            auto sent = ::send(fd_, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("send: ") + std::strerror(errno));
+            }
+            bytes = bytes.subspan(sent);
+        }
+    }
+
+    // False if the peer closed the connection before the first byte.
+    bool ReceiveAll(std::span<std::byte> bytes) {
+        size_t done = 0;
+        while (done < bytes.size()) {
+            auto received = ::recv(fd_, bytes.data() + done, bytes.size() - done, 0);
+            if (received < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("recv: ") + std::strerror(errno));
+            }
+            if (received == 0) {
+                if (done == 0) {
+                    return false;
+                }
+                throw std::runtime_error("connection closed mid-message");
+            }
+            done += received;
+        }
+        return true;
+    }
+
+    int fd_ = -1;
+};
+
+inline constexpr std::string_view UNIX_PREFIX = "unix:";
+
+inline std::pair<std::string, std::string> SplitHostPort(const std::string& address) {
+    auto colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::runtime_error("expected unix:path or host:port, got " + address);
+    }
+    return {address.substr(0, colon), address.substr(colon + 1)};
+}
+
+inline sockaddr_un UnixAddress(const std::string& address) {
+    auto path = address.substr(UNIX_PREFIX.size());
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("socket path is too long: " + path);
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+inline Socket Listen(const std::string& address) {
+    if (address.starts_with(UNIX_PREFIX)) {
+        auto addr = UnixAddress(address);
+        // A socket file left behind by a previous run.
+        ::unlink(addr.sun_path);
+        Socket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (socket.Fd() < 0 || ::bind(socket.Fd(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            ::listen(socket.Fd(), SOMAXCONN) != 0) {
+            throw std::runtime_error("cannot listen on " + address + ": " + std::strerror(errno));
+        }
+        return socket;
+    }
+    auto [host, port] = SplitHostPort(address);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* info = nullptr;
+    if (::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &info) != 0) {
+        throw std::runtime_error("cannot resolve " + address);
+    }
+    std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> guard(info, ::freeaddrinfo);
+    Socket socket(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+    int yes = 1;
+    if (socket.Fd() < 0 || ::setsockopt(socket.Fd(), SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) != 0 ||
+        ::bind(socket.Fd(), info->ai_addr, info->ai_addrlen) != 0 || ::listen(socket.Fd(), SOMAXCONN) != 0) {
+        throw std::runtime_error("cannot listen on " + address + ": " + std::strerror(errno));
+    }
+    return socket;
+}
+
+// Keeps trying for `patience`, so workers can be started before the coordinator.
+inline Socket Connect(const std::string& address, std::chrono::seconds patience = std::chrono::seconds(30)) {
+    auto deadline = std::chrono::steady_clock::now() + patience;
+    while (true) {
+        Socket socket;
+        if (address.starts_with(UNIX_PREFIX)) {
+            auto addr = UnixAddress(address);
+            socket = Socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+            if (socket.Fd() >= 0 && ::connect(socket.Fd(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+                return socket;
+            }
+        } else {
+            auto [host, port] = SplitHostPort(address);
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* info = nullptr;
+            if (::getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &info) != 0) {
+                throw std::runtime_error("cannot resolve " + address);
+            }
+            std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> guard(info, ::freeaddrinfo);
+            socket = Socket(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+            if (socket.Fd() >= 0 && ::connect(socket.Fd(), info->ai_addr, info->ai_addrlen) == 0) {
+                int yes = 1;
+                ::setsockopt(socket.Fd(), IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+                return socket;
+            }
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            throw std::runtime_error("cannot connect to " + address + ": " + std::strerror(errno));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+// Hands out batches of games to the connected workers and collects their results. Every worker
+// keeps up to MAX_IN_FLIGHT games queued, so it never waits for the coordinator between games.
+class Coordinator {
+public:
+    static constexpr size_t MAX_IN_FLIGHT = 2;
+
+    explicit Coordinator(const std::string& address) : address_(address), listener_(Listen(address)) {
+    }
+
+    Coordinator(const Coordinator&) = delete;
+    Coordinator& operator=(const Coordinator&) = delete;
+
+    ~Coordinator() {
+        for (auto& worker : workers_) {
+            try {
+                worker.socket.Send(MessageType::Bye);
+            } catch (const std::runtime_error&) {
+            }
+        }
+        if (address_.starts_with(UNIX_PREFIX)) {
+            ::unlink(UnixAddress(address_).sun_path);
+        }
+    }
+
+    // Blocks until every game has a result, waiting for workers if none are connected. onResult
+    // gets the index of the assignment and runs on the calling thread.
+    void Play(const std::vector<GameAssignment>& assignments,
+              const std::function<void(size_t, GameResult)>& onResult) {
+        ForgetUnused(assignments);
+        std::deque<size_t> queue(assignments.size());
+        std::iota(queue.begin(), queue.end(), 0);
+        size_t remaining = assignments.size();
+        std::vector<pollfd> fds;
+        while (remaining > 0) {
+            Dispatch(assignments, queue);
+            if (workers_.empty()) {
+                Log() << "Waiting for workers on " << address_;
+            }
+
+            fds.clear();
+            fds.push_back({listener_.Fd(), POLLIN, 0});
+            for (const auto& worker : workers_) {
+                fds.push_back({worker.socket.Fd(), POLLIN, 0});
+            }
+            if (::poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("poll: ") + std::strerror(errno));
+            }
+
+            // Walk backwards, dropped workers are erased from the list.
+            for (size_t i = workers_.size(); i > 0; --i) {
+                if (fds[i].revents == 0) {
+                    continue;
+                }
+                auto& worker = workers_[i - 1];
+                try {
+                    if (!ReceiveFrom(worker, onResult, remaining)) {
+                        Drop(i - 1, queue, "disconnected");
+                    }
+                } catch (const std::runtime_error& e) {
+                    Drop(i - 1, queue, e.what());
+                }
+            }
+            if (fds[0].revents & POLLIN) {
+                Accept();
+            }
+        }
+    }
+
+    size_t NumWorkers() const {
+        return workers_.size();
+    }
+
+private:
+    struct WorkerConnection {
+        Socket socket;
+        bool greeted = false;
+        // Ids of the networks the worker has.
+        std::set<std::uint32_t> nets;
+        // Indices of the assignments it plays.
+        std::vector<size_t> inFlight;
+    };
+
+    void Accept() {
+        Socket socket(::accept(listener_.Fd(), nullptr, nullptr));
+        if (socket.Fd() < 0) {
+            return;
+        }
+        int yes = 1;
+        ::setsockopt(socket.Fd(), IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        WorkerConnection worker;
+        worker.socket = std::move(socket);
+        workers_.push_back(std::move(worker));
+    }
+
+    // False once the worker closed the connection.
+    bool ReceiveFrom(WorkerConnection& worker, const std::function<void(size_t, GameResult)>& onResult,
+                     size_t& remaining) {
+        auto message = worker.socket.Receive();
+        if (!message) {
+            return false;
+        }
+        Reader reader(message->payload);
+        if (message->type == MessageType::Hello) {
+            auto version = reader.Get<std::uint32_t>();
+            if (version != PROTOCOL_VERSION) {
+                throw std::runtime_error("protocol version " + std::to_string(version));
+            }
+            worker.greeted = true;
+            Log() << "Worker joined, " << workers_.size() << " connected";
+            return true;
+        }
+        if (message->type != MessageType::Result) {
+            throw std::runtime_error("unexpected message from a worker");
+        }
+        auto index = reader.Get<std::uint64_t>();
+        auto it = std::find(worker.inFlight.begin(), worker.inFlight.end(), index);
+        if (it == worker.inFlight.end()) {
+            throw std::runtime_error("result of a game the worker does not play");
+        }
+        worker.inFlight.erase(it);
+        GameResult result;
+        result.win = reader.Get<std::int32_t>();
+        result.adjudication = reader.Get<Adjudication>();
+        result.plies = reader.Get<std::int32_t>();
+        result.records.resize(reader.Get<std::uint32_t>());
+        auto bytes = reader.Take(result.records.size() * sizeof(TrainingRecord));
+        std::memcpy(result.records.data(), bytes.data(), bytes.size());
+        --remaining;
+        onResult(index, std::move(result));
+        return true;
+    }
+
+    void Drop(size_t workerInd, std::deque<size_t>& queue, const std::string& reason) {
+        auto& worker = workers_[workerInd];
+        Log() << "Worker dropped (" << reason << "), " << worker.inFlight.size() << " games requeued";
+        queue.insert(queue.begin(), worker.inFlight.begin(), worker.inFlight.end());
+        workers_.erase(workers_.begin() + workerInd);
+    }
+
+    void Dispatch(const std::vector<GameAssignment>& assignments, std::deque<size_t>& queue) {
+        for (size_t i = workers_.size(); i > 0 && !queue.empty(); --i) {
+            auto& worker = workers_[i - 1];
+            try {
+                while (worker.greeted && worker.inFlight.size() < MAX_IN_FLIGHT && !queue.empty()) {
+                    auto index = queue.front();
+                    Send(worker, index, assignments[index]);
+                    queue.pop_front();
+                    worker.inFlight.push_back(index);
+                }
+            } catch (const std::runtime_error& e) {
+                Drop(i - 1, queue, e.what());
+            }
+        }
+    }
+
+    void Send(WorkerConnection& worker, size_t index, const GameAssignment& assignment) {
+        auto white = SendNet(worker, assignment.white.parent);
+        auto black = SendNet(worker, assignment.black.parent);
+        Writer writer;
+        writer.Put<std::uint64_t>(index)
+            .Put(white).Put(assignment.white.seed)
+            .Put(black).Put(assignment.black.seed)
+            .Put<std::uint64_t>(assignment.mutation.size).Put(assignment.mutation.sigma)
+            .Put(assignment.gameInd).Put<std::uint8_t>(assignment.record).Put<std::uint8_t>(assignment.canonical)
+            .Put(assignment.adjudication);
+        worker.socket.Send(MessageType::Game, writer.Data());
+    }
+
+    // The id of the network, sent to the worker first if it does not have it. Zero is no network.
+    std::uint32_t SendNet(WorkerConnection& worker, const std::shared_ptr<const ValueNet>& net) {
+        if (!net) {
+            return 0;
+        }
+        auto [it, inserted] = ids_.try_emplace(net.get(), nextId_, net);
+        if (inserted) {
+            ++nextId_;
+        }
+        auto id = it->second.first;
+        if (worker.nets.insert(id).second) {
+            Writer writer;
+            writer.Put(id).Put(std::as_bytes(net->Params()));
+            worker.socket.Send(MessageType::Net, writer.Data());
+        }
+        return id;
+    }
+
+    // Networks of past generations are not played again, workers drop them from their caches.
+    void ForgetUnused(const std::vector<GameAssignment>& assignments) {
+        std::set<const ValueNet*> used;
+        for (const auto& assignment : assignments) {
+            used.insert(assignment.white.parent.get());
+            used.insert(assignment.black.parent.get());
+        }
+        std::vector<std::uint32_t> forgotten;
+        for (auto it = ids_.begin(); it != ids_.end();) {
+            if (used.contains(it->first)) {
+                ++it;
+                continue;
+            }
+            forgotten.push_back(it->second.first);
+            it = ids_.erase(it);
+        }
+        if (forgotten.empty()) {
+            return;
+        }
+        Writer writer;
+        writer.Put<std::uint32_t>(forgotten.size());
+        for (auto id : forgotten) {
+            writer.Put(id);
+        }
+        for (auto& worker : workers_) {
+            for (auto id : forgotten) {
+                worker.nets.erase(id);
+            }
+            try {
+                worker.socket.Send(MessageType::Forget, writer.Data());
+            } catch (const std::runtime_error&) {
+                // Play notices the broken connection.
+            }
+        }
+    }
+
+    std::string address_;
+    Socket listener_;
+    std::vector<WorkerConnection> workers_;
+    // Holds the networks the workers may have, so their addresses are not reused by new ones.
+    std::map<const ValueNet*, std::pair<std::uint32_t, std::shared_ptr<const ValueNet>>> ids_;
+    std::uint32_t nextId_ = 1;
+};
+
+// Plays the games of a coordinator one after another until it says goodbye or goes away.
+class Worker {
+public:
+    using PlayFn = std::function<GameResult(const GameAssignment&)>;
+
+    Worker(const std::string& address, PlayFn play) : socket_(Connect(address)), play_(std::move(play)) {
+    }
+
+    // Returns the number of games played.
+    size_t Run() {
+        socket_.Send(MessageType::Hello, Writer().Put(PROTOCOL_VERSION).Data());
+        size_t numGames = 0;
+        while (auto message = socket_.Receive()) {
+            Reader reader(message->payload);
+            switch (message->type) {
+            case MessageType::Net: {
+                auto id = reader.Get<std::uint32_t>();
+                auto net = std::make_shared<ValueNet>();
+                auto bytes = reader.Take(net->Params().size_bytes());
+                std::memcpy(net->Params().data(), bytes.data(), bytes.size());
+                nets_[id] = std::move(net);
+                break;
+            }
+            case MessageType::Forget: {
+                auto count = reader.Get<std::uint32_t>();
+                for (std::uint32_t i = 0; i < count; ++i) {
+                    nets_.erase(reader.Get<std::uint32_t>());
+                }
+                break;
+            }
+            case MessageType::Game: {
+                auto index = reader.Get<std::uint64_t>();
+                GameAssignment assignment;
+                assignment.white = ReadGenome(reader);
+                assignment.black = ReadGenome(reader);
+                assignment.mutation.size = reader.Get<std::uint64_t>();
+                assignment.mutation.sigma = reader.Get<float>();
+                assignment.gameInd = reader.Get<std::uint32_t>();
+                assignment.record = reader.Get<std::uint8_t>();
+                assignment.canonical = reader.Get<std::uint8_t>();
+                assignment.adjudication = reader.Get<AdjudicationConfig>();
+                auto result = play_(assignment);
+                Writer writer;
+                writer.Put(index).Put<std::int32_t>(result.win).Put(result.adjudication)
+                    .Put<std::int32_t>(result.plies).Put<std::uint32_t>(result.records.size())
+                    .Put(std::as_bytes(std::span(result.records)));
+                socket_.Send(MessageType::Result, writer.Data());
+                ++numGames;
+                break;
+            }
+            case MessageType::Bye:
+                return numGames;
+            default:
+                throw std::runtime_error("unexpected message from the coordinator");
+            }
+        }
+        return numGames;
+    }
+
+private:
+    Genome ReadGenome(Reader& reader) const {
+        auto id = reader.Get<std::uint32_t>();
+        Genome genome;
+        genome.seed = reader.Get<std::uint64_t>();
+        if (id != 0) {
+            auto it = nets_.find(id);
+            if (it == nets_.end()) {
+                throw std::runtime_error("unknown network " + std::to_string(id));
+            }
+            genome.parent = it->second;
+        }
+        return genome;
+    }
+
+    Socket socket_;
+    PlayFn play_;
+    std::unordered_map<std::uint32_t, std::shared_ptr<const ValueNet>> nets_;
+};
+
+}  // namespace distributed
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "position.h"
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+
+// Raw network outputs by board and network, shared by all bots and threads of a process. The
+// networks only see the pieces, so positions that differ in the side to move or the draw counter
+// share an entry.
+//
+// Buckets are one cache line of WAYS entries behind a spinlock. Lookups mark their entry as
+// referenced, an insertion into a full bucket evicts the first unreferenced entry from the
+// bucket's clock hand on, clearing the marks it passes.
+class EvalCache {
+public:
+    static constexpr std::uint32_t WAYS = 3;
+
+    struct Counters {
+        std::uint64_t lookups = 0;
+        std::uint64_t hits = 0;
+        std::uint64_t insertions = 0;
+        std::uint64_t evictions = 0;
+
+        double HitRate() const {
+            return lookups == 0 ? 0 : static_cast<double>(hits) / lookups;
+        }
+
+        Counters operator-(const Counters& rhs) const {
+            return {lookups - rhs.lookups, hits - rhs.hits, insertions - rhs.insertions, evictions - rhs.evictions};
+        }
+    };
+
+    // Rounded up to whole buckets and a power of two of them.
+    explicit EvalCache(size_t numEntries)
+        : numBuckets_(std::bit_ceil(std::max<size_t>(1, (numEntries + WAYS - 1) / WAYS))),
+          buckets_(std::make_unique<Bucket[]>(numBuckets_)) {
+    }
+
+    // A process-unique id for a set of weights. An id must not be reused for other weights, so a
+    // network gets a new one whenever it changes.
+    static std::uint32_t NewNetworkId() {
+        static std::atomic<std::uint32_t> next = 1;
+        auto id = next.fetch_add(1, std::memory_order_relaxed);
+        if (id == 0) {
+            throw std::runtime_error("out of network ids");
+        }
+        return id;
+    }
+
+    std::optional<float> Find(const Position& position, std::uint32_t netId) {
+        lookups_.fetch_add(1, std::memory_order_relaxed);
+        auto& bucket = BucketOf(position, netId);
+        Lock lock(bucket);
+        for (std::uint32_t way = 0; way < WAYS; ++way) {
+            if (bucket.entries[way].Matches(position, netId)) {
+                bucket.referenced |= 1 << way;
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return bucket.entries[way].value;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void Insert(const Position& position, std::uint32_t netId, float value) {
+        insertions_.fetch_add(1, std::memory_order_relaxed);
+        auto& bucket = BucketOf(position, netId);
+        Lock lock(bucket);
+        auto way = Victim(bucket, position, netId);
+        auto& entry = bucket.entries[way];
+        if (entry.netId != 0 && !entry.Matches(position, netId)) {
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+        entry = {position.whites, position.blacks, position.queens, netId, value};
+        bucket.referenced |= 1 << way;
+    }
+
+    // The cached output or the one of `evaluate`, which is then cached.
+    template <class Evaluate>
+    float GetOrEvaluate(const Position& position, std::uint32_t netId, Evaluate&& evaluate) {
+        if (auto value = Find(position, netId)) {
+            return *value;
+        }
+        float value = evaluate();
+        Insert(position, netId, value);
+        return value;
+    }
+
+    Counters GetCounters() const {
+        return {lookups_.load(std::memory_order_relaxed), hits_.load(std::memory_order_relaxed),
+                insertions_.load(std::memory_order_relaxed), evictions_.load(std::memory_order_relaxed)};
+    }
+
+    size_t Capacity() const {
+        return numBuckets_ * WAYS;
+    }
+
+private:
+    struct Entry {
+        std::uint32_t whites = 0;
+        std::uint32_t blacks = 0;
+        std::uint32_t queens = 0;
+        // Zero for an empty entry.
+        std::uint32_t netId = 0;
+        float value = 0;
+
+        bool Matches(const Position& position, std::uint32_t id) const {
+            return netId == id && whites == position.whites && blacks == position.blacks &&
+                   queens == position.queens;
+        }
+    };
+
+    struct alignas(64) Bucket {
+        std::atomic_flag locked;
+        std::uint8_t hand = 0;
+        std::uint8_t referenced = 0;
+        Entry entries[WAYS];
+    };
+
+    static_assert(sizeof(Bucket) == 64);
+
+    class Lock {
+    public:
+        explicit Lock(Bucket& bucket) : bucket_(bucket) {
+            while (bucket_.locked.test_and_set(std::memory_order_acquire)) {
+                bucket_.locked.wait(true, std::memory_order_relaxed);
+            }
+        }
+
+        ~Lock() {
+            bucket_.locked.clear(std::memory_order_release);
+            bucket_.locked.notify_one();
+        }
+
+    private:
+        Bucket& bucket_;
+    };
+
+    // The entry of the position if another thread got to insert it first, an unreferenced one
+    // otherwise. Empty entries are never referenced.
+    static std::uint32_t Victim(Bucket& bucket, const Position& position, std::uint32_t netId) {
+        for (std::uint32_t way = 0; way < WAYS; ++way) {
+            if (bucket.entries[way].Matches(position, netId)) {
+                return way;
+            }
+        }
+        while (bucket.referenced & (1 << bucket.hand)) {
+            bucket.referenced &= ~(1 << bucket.hand);
+            bucket.hand = (bucket.hand + 1) % WAYS;
+        }
+        auto way = bucket.hand;
+        bucket.hand = (bucket.hand + 1) % WAYS;
+        return way;
+    }
+
+    Bucket& BucketOf(const Position& position, std::uint32_t netId) {
+        // splitmix64's finalizer over the pieces and the network.
+        std::uint64_t hash = (static_cast<std::uint64_t>(position.whites) << 32 | position.blacks) ^
+                             (static_cast<std::uint64_t>(position.queens) << 32 | netId) * 0x9E3779B97F4A7C15ULL;
+        hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+        hash ^= hash >> 31;
+        return buckets_[hash & (numBuckets_ - 1)];
+    }
+
+    const size_t numBuckets_;
+    std::unique_ptr<Bucket[]> buckets_;
+    std::atomic<std::uint64_t> lookups_ = 0;
+    std::atomic<std::uint64_t> hits_ = 0;
+    std::atomic<std::uint64_t> insertions_ = 0;
+    std::atomic<std::uint64_t> evictions_ = 0;
+};
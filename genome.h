@@ -0,0 +1,70 @@
+#pragma once
+
+#include "random.h"
+#include "value_net.h"
+
+#include <memory>
+
+struct Mutation {
+    // Number of parameters a child changes, 0 adds noise to all of them.
+    size_t size = 64;
+    float sigma = 0.1F;
+};
+
+// A network stored as a reference to its parent's weights plus the seed of a sparse mutation.
+// Children of one parent share its weights and cost a few bytes each, the full network is only
+// built when it is about to play.
+struct Genome {
+    // Null for a freshly initialized ValueNet(seed).
+    std::shared_ptr<const ValueNet> parent;
+    // Zero for an exact copy of the parent.
+    std::uint64_t seed = 0;
+
+    // Builds the weights in place, reusing the storage of net.
+    void Materialize(ValueNet& net, const Mutation& mutation) const {
+        if (!parent) {
+            net = ValueNet(seed);
+            return;
+        }
+        auto from = parent->Params();
+        std::copy(from.begin(), from.end(), net.Params().begin());
+        if (seed != 0) {
+            ApplyMutation(net, mutation);
+        }
+    }
+
+    // Shares the parent's weights when there is nothing to apply.
+    std::shared_ptr<const ValueNet> Materialize(const Mutation& mutation) const {
+        if (parent && seed == 0) {
+            return parent;
+        }
+        auto net = std::make_shared<ValueNet>();
+        Materialize(*net, mutation);
+        return net;
+    }
+
+private:
+    // Depends on the seed only, so children can be built on any thread in any order.
+    void ApplyMutation(ValueNet& net, const Mutation& mutation) const {
+        Philox rng(seed);
+        auto params = net.Params();
+        std::array<float, 256> noise;
+        if (mutation.size == 0) {
+            for (size_t i = 0; i < params.size(); i += noise.size()) {
+                auto chunk = std::min(noise.size(), params.size() - i);
+                FillNormal(rng, std::span(noise).first(chunk), 0, mutation.sigma);
+                for (size_t j = 0; j < chunk; ++j) {
+                    params[i + j] += noise[j];
+                }
+            }
+            return;
+        }
+        for (size_t i = 0; i < mutation.size; i += noise.size()) {
+            auto chunk = std::min(noise.size(), mutation.size - i);
+            FillNormal(rng, std::span(noise).first(chunk), 0, mutation.sigma);
+            for (size_t j = 0; j < chunk; ++j) {
+                params[rng.Below(params.size())] += noise[j];
+            }
+        }
+    }
+};
@@ -1,4 +1,15 @@
+#include "adjudication.h"
+#include "alloc_tracker.h"
+#include "dataset.h"
+#include "distributed.h"
+#include "eval_cache.h"
+#include "genome.h"
+#include "mcts.h"
+#include "position.h"
+#include "random.h"
+#include "time_control.h"
 #include "utils.h"
+#include "value_net.h"
 
 #include <mynn/mynn.h>
 
@@ -6,16 +17,19 @@
 
 #include <algorithm>
 #include <cassert>
+#include <ctime>
 #include <functional>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <fstream>
-
-static constexpr int INPUT_DIM = 5;
-static constexpr int INPUT_ROWS = 32;
+#include <numeric>
+#include <optional>
+#include <random>
+#include <semaphore>
 
 int ToCellId(int x, int y, int numCols) {
     return (y / 80) * numCols + x / 80;
@@ -54,6 +68,7 @@ public:
     virtual void ShowMoves(const std::unique_ptr<PathNode>& moves) {
     }
 
+    // An empty boardFilename uses the board generated in memory.
     virtual void InitBoard(const std::string& boardFilename, const std::vector<Piece>& whitePieces,
                            const std::vector<Piece>& blackPieces,
                            int numRows, int numCols) {
@@ -61,6 +76,11 @@ public:
 
     virtual void Render() = 0;
 
+    // Whether anything changed since the last Render.
+    virtual bool IsDirty() const {
+        return false;
+    }
+
     virtual void SetWhitesQueen(int pieceId) {
     }
 
@@ -85,132 +105,376 @@ public:
     }
 };
 
+// Performance overlay in the corner of the board. The text uses a built-in 3x5 pixel font drawn as
+// untextured quads, so it needs no font file and costs one draw call. The text is rebuilt at most
+// every REFRESH_PERIOD.
+class Hud {
+public:
+    inline static const sf::Time REFRESH_PERIOD = sf::milliseconds(500);
+
+    struct Values {
+        float frameMs = 0;
+        int drawCalls = 0;
+        float thinkMs = 0;
+        // Total so far, the HUD turns it into a rate.
+        std::uint64_t evaluations = 0;
+        float eval = 0;
+        // Seconds left on the clocks, shown if there is a time control.
+        std::optional<float> whiteSeconds;
+        std::optional<float> blackSeconds;
+    };
+
+    // Returns whether the text changed.
+    bool Update(const Values& values) {
+        auto elapsed = clock_.getElapsedTime();
+        if (vertices_.getVertexCount() != 0 && elapsed < REFRESH_PERIOD) {
+            return false;
+        }
+        auto evalsPerSec = (values.evaluations - lastEvaluations_) / elapsed.asSeconds();
+        lastEvaluations_ = values.evaluations;
+        clock_.restart();
+
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(1)
+           << "FRAME MS " << values.frameMs << '\n'
+           << "DRAWS " << values.drawCalls << '\n'
+           << "THINK MS " << values.thinkMs << '\n'
+           << "EVALS/S " << std::setprecision(0) << evalsPerSec << '\n'
+           << "EVAL " << std::setprecision(2) << values.eval;
+        if (values.whiteSeconds && values.blackSeconds) {
+            ss << std::setprecision(1) << "\nWHITE " << *values.whiteSeconds << "\nBLACK " << *values.blackSeconds;
+        }
+        Build(ss.str());
+        return true;
+    }
+
+    void Draw(sf::RenderTarget& target) const {
+        target.draw(vertices_);
+    }
+
+private:
+    static constexpr float PIXEL = 3;
+    static constexpr float MARGIN = 2 * PIXEL;
+    static constexpr int GLYPH_WIDTH = 3;
+    static constexpr int GLYPH_HEIGHT = 5;
+    static constexpr int LINE_CHARS = 16;
+
+    // Rows from the top, three bits each with the leftmost column in the highest bit.
+    static std::uint16_t Glyph(char c) {
+        auto rows = [](int r0, int r1, int r2, int r3, int r4) {
+            return static_cast<std::uint16_t>(r0 << 12 | r1 << 9 | r2 << 6 | r3 << 3 | r4);
+        };
+        switch (c) {
+            case '0': return rows(07, 05, 05, 05, 07);
+            case '1': return rows(02, 06, 02, 02, 07);
+            case '2': return rows(07, 01, 07, 04, 07);
+            case '3': return rows(07, 01, 07, 01, 07);
+            case '4': return rows(05, 05, 07, 01, 01);
+            case '5': return rows(07, 04, 07, 01, 07);
+            case '6': return rows(07, 04, 07, 05, 07);
+            case '7': return rows(07, 01, 01, 01, 01);
+            case '8': return rows(07, 05, 07, 05, 07);
+            case '9': return rows(07, 05, 07, 01, 07);
+            case 'A': return rows(02, 05, 07, 05, 05);
+            case 'B': return rows(06, 05, 06, 05, 06);
+            case 'C': return rows(07, 04, 04, 04, 07);
+            case 'D': return rows(06, 05, 05, 05, 06);
+            case 'E': return rows(07, 04, 06, 04, 07);
+            case 'F': return rows(07, 04, 06, 04, 04);
+            case 'H': return rows(05, 05, 07, 05, 05);
+            case 'I': return rows(07, 02, 02, 02, 07);
+            case 'K': return rows(05, 05, 06, 05, 05);
+            case 'L': return rows(04, 04, 04, 04, 07);
+            case 'M': return rows(05, 07, 07, 05, 05);
+            case 'N': return rows(06, 05, 05, 05, 05);
+            case 'R': return rows(06, 05, 06, 05, 05);
+            case 'S': return rows(03, 04, 02, 01, 06);
+            case 'T': return rows(07, 02, 02, 02, 02);
+            case 'V': return rows(05, 05, 05, 05, 02);
+            case 'W': return rows(05, 05, 07, 07, 05);
+            case '.': return rows(00, 00, 00, 00, 02);
+            case '-': return rows(00, 00, 07, 00, 00);
+            case '/': return rows(01, 01, 02, 04, 04);
+            default: return 0;
+        }
+    }
+
+    void AddQuad(sf::Vector2f position, sf::Vector2f size, sf::Color color) {
+        const sf::Vector2f corners[] = {{0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1}};
+        for (auto corner : corners) {
+            vertices_.append(sf::Vertex({position.x + corner.x * size.x, position.y + corner.y * size.y}, color));
+        }
+    }
+
+    void Build(const std::string& text) {
+        vertices_.clear();
+        const float advance = (GLYPH_WIDTH + 1) * PIXEL;
+        const float lineHeight = (GLYPH_HEIGHT + 2) * PIXEL;
+        const auto numLines = 1 + std::count(text.begin(), text.end(), '\n');
+        AddQuad({0, 0}, {2 * MARGIN + LINE_CHARS * advance, 2 * MARGIN + numLines * lineHeight},
+                sf::Color(0, 0, 0, 160));
+        sf::Vector2f cursor(MARGIN, MARGIN);
+        for (char c : text) {
+            if (c == '\n') {
+                cursor = {MARGIN, cursor.y + lineHeight};
+                continue;
+            }
+            auto glyph = Glyph(c);
+            for (int row = 0; row < GLYPH_HEIGHT; ++row) {
+                for (int col = 0; col < GLYPH_WIDTH; ++col) {
+                    if (glyph >> ((GLYPH_HEIGHT - 1 - row) * GLYPH_WIDTH + (GLYPH_WIDTH - 1 - col)) & 1) {
+                        AddQuad({cursor.x + col * PIXEL, cursor.y + row * PIXEL}, {PIXEL, PIXEL}, sf::Color::White);
+                    }
+                }
+            }
+            cursor.x += advance;
+        }
+    }
+
+    sf::VertexArray vertices_{sf::Triangles};
+    sf::Clock clock_;
+    std::uint64_t lastEvaluations_ = 0;
+};
+
+// Draws the board sprite and then all highlights and pieces as one vertex array textured from a
+// pre-rendered atlas: two draw calls per frame. The vertices are rebuilt only after a change.
+// Draws to a window or, for batch rendering, to an sf::RenderTexture.
 class BoardRenderer : public Renderer {
 public:
-    explicit BoardRenderer(sf::RenderWindow& window)
-        : window_(window) {
+    explicit BoardRenderer(sf::RenderTarget& target, const sf::ContextSettings& settings = sf::ContextSettings())
+        : target_(target), settings_(settings) {
     }
 
     void RemoveHighlightFromPieces(const std::unordered_set<int>& availablePieces) override {
         for (auto pieceId : availablePieces) {
-            pieces_.at(pieceId).setOutlineColor(color::LIGHT_DIM_GREY);
+            pieces_.at(pieceId).highlighted = false;
         }
+        dirty_ = true;
     }
 
     void RemoveHighlightFromMoves(const std::unique_ptr<PathNode>& moves) override {
         for (auto& move : moves->children) {
             if (!move->isEmptyCell) {
                 for (auto& jump : move->children) {
-                    squaresToDraw_.erase(jump->cellId);
+                    highlightedCells_.at(jump->cellId) = false;
                 }
             } else {
-                squaresToDraw_.erase(move->cellId);
+                highlightedCells_.at(move->cellId) = false;
             }
         }
+        dirty_ = true;
     }
 
     void ShowMoves(const std::unique_ptr<PathNode>& moves) override {
         for (auto& move : moves->children) {
             if (!move->isEmptyCell) {
                 for (auto& jump : move->children) {
-                    squaresToDraw_.insert(jump->cellId);
+                    highlightedCells_.at(jump->cellId) = true;
                 }
             } else {
-                squaresToDraw_.insert(move->cellId);
+                highlightedCells_.at(move->cellId) = true;
             }
         }
+        dirty_ = true;
     }
 
     void InitBoard(const std::string& boardFilename, const std::vector<Piece>& whitePieces,
                    const std::vector<Piece>& blackPieces,
                    int numRows, int numCols) override {
         numCols_ = numCols;
-        auto loaded = texture_.loadFromFile(boardFilename);
-        if (!loaded) {
-            throw std::runtime_error("cannot load from " + boardFilename);
-        }
-        Log() << "Loaded board from " << boardFilename;
-        sprite_.setTexture(texture_);
-
-        for (int i = 0; i < numRows; ++i) {
-            for (int j = 0; j < numCols; ++j) {
-                sf::Vector2f position = {j * CELL_SIZE, i * CELL_SIZE};
-                boardSquares_.emplace_back(sf::Vector2f{CELL_SIZE, CELL_SIZE});
-                boardSquares_.back().setPosition(position);
-                boardSquares_.back().setFillColor(color::AVAILABLE_MOVE);
+        if (boardFilename.empty()) {
+            texture_.loadFromImage(BoardImage(numRows, numCols));
+        } else {
+            auto loaded = texture_.loadFromFile(boardFilename);
+            if (!loaded) {
+                throw std::runtime_error("cannot load from " + boardFilename);
             }
+            Log() << "Loaded board from " << boardFilename;
         }
+        sprite_.setTexture(texture_, true);
 
+        highlightedCells_.assign(numRows * numCols, false);
         pieces_.resize(whitePieces.size() + blackPieces.size());
-
-        auto setPiece = [&](auto& piece, auto cellId, auto color, auto outlineColor) {
-            piece = sf::CircleShape(PIECE_RADIUS);
-            piece.setPosition(ToVector(cellId, numCols_));
-            piece.setFillColor(color);
-            piece.setOutlineColor(outlineColor);
-            piece.setOutlineThickness(2.f);
-        };
-
         for (const auto&[id, piece] : Enumerate(blackPieces)) {
-            setPiece(pieces_.at(id), piece.cellId, color::DIM_GREY, color::GREY);
+            pieces_.at(id) = {piece.cellId, false, piece.isQueen, false};
         }
-
         for (const auto&[id, piece] : Enumerate(whitePieces)) {
-            setPiece(pieces_.at(id + blackPieces.size()), piece.cellId, color::WHITE_SMOKE,
-                     color::LIGHT_DIM_GREY);
+            pieces_.at(id + blackPieces.size()) = {piece.cellId, true, piece.isQueen, false};
         }
+
+        InitAtlas();
+        dirty_ = true;
     }
 
     void Render() override {
-        window_.draw(sprite_);
-        for (auto cellId : squaresToDraw_) {
-            window_.draw(boardSquares_[cellId]);
+        PROFILE_SCOPE("BoardRenderer::Render");
+        if (dirty_) {
+            BuildVertices();
+            dirty_ = false;
         }
-        for (const auto& piece : pieces_) {
-            window_.draw(piece);
+        target_.draw(sprite_);
+        target_.draw(vertices_, &atlas_.getTexture());
+        drawCalls_ = 2;
+        if (hudVisible_) {
+            hud_.Draw(target_);
+            ++drawCalls_;
+        }
+    }
+
+    bool IsDirty() const override {
+        return dirty_;
+    }
+
+    void ToggleHud() {
+        hudVisible_ = !hudVisible_;
+        dirty_ = true;
+    }
+
+    bool HudVisible() const {
+        return hudVisible_;
+    }
+
+    // Feeds the HUD, which redraws only when its text is due for a refresh.
+    void UpdateHud(Hud::Values values) {
+        if (hudVisible_) {
+            values.drawCalls = drawCalls_;
+            dirty_ |= hud_.Update(values);
         }
-        window_.display();
     }
 
     void SetWhitesQueen(int pieceId) override {
-        pieces_.at(pieceId).setFillColor(color::SOFT_YELLOW);
+        pieces_.at(pieceId).isQueen = true;
+        dirty_ = true;
     }
 
     void SetBlacksQueen(int pieceId) override {
-        pieces_.at(pieceId).setFillColor(color::RAINBOW_INDIGO);
+        pieces_.at(pieceId).isQueen = true;
+        dirty_ = true;
     }
 
     void HighlightPieces(const std::unordered_set<int>& availablePieces) override {
         for (auto pieceId : availablePieces) {
-            pieces_.at(pieceId).setOutlineColor(sf::Color::Green);
+            pieces_.at(pieceId).highlighted = true;
         }
+        dirty_ = true;
     }
 
     void SetPiecePosition(int pieceId, int cellId) override {
-        pieces_.at(pieceId).setPosition(ToVector(cellId, numCols_));
+        pieces_.at(pieceId).cellId = cellId;
+        dirty_ = true;
     }
 
     void ErasePiece(int pieceId) override {
-        pieces_.at(pieceId).setPosition(UNDEFINED_POSITION);
+        pieces_.at(pieceId).cellId = -1;
+        dirty_ = true;
     }
 
 private:
-    sf::RenderWindow& window_;
+    struct PieceSprite {
+        int cellId = -1;
+        bool isWhite = false;
+        bool isQueen = false;
+        bool highlighted = false;
+    };
+
+    static constexpr float OUTLINE = 2;
+    static constexpr float TILE_SIZE = 2 * (PIECE_RADIUS + OUTLINE);
+    // Tiles 0-7 are the pieces by (white, queen, highlighted), tile 8 is the move highlight.
+    static constexpr int HIGHLIGHT_TILE = 8;
+
+    static int TileOf(const PieceSprite& piece) {
+        return (piece.isWhite * 2 + piece.isQueen) * 2 + piece.highlighted;
+    }
+
+    void InitAtlas() {
+        atlas_.create(static_cast<unsigned>(TILE_SIZE * (HIGHLIGHT_TILE + 1)), static_cast<unsigned>(TILE_SIZE),
+                      settings_);
+        atlas_.clear(sf::Color::Transparent);
+        for (int tile = 0; tile < HIGHLIGHT_TILE; ++tile) {
+            bool isWhite = tile & 4;
+            bool isQueen = tile & 2;
+            bool highlighted = tile & 1;
+            sf::CircleShape piece(PIECE_RADIUS);
+            piece.setPosition(tile * TILE_SIZE + OUTLINE, OUTLINE);
+            piece.setOutlineThickness(OUTLINE);
+            if (isWhite) {
+                piece.setFillColor(isQueen ? color::SOFT_YELLOW : color::WHITE_SMOKE);
+                piece.setOutlineColor(color::LIGHT_DIM_GREY);
+            } else {
+                piece.setFillColor(isQueen ? color::RAINBOW_INDIGO : color::DIM_GREY);
+                piece.setOutlineColor(color::GREY);
+            }
+            if (highlighted) {
+                piece.setOutlineColor(sf::Color::Green);
+            }
+            atlas_.draw(piece);
+        }
+        sf::RectangleShape highlight({TILE_SIZE, TILE_SIZE});
+        highlight.setPosition(HIGHLIGHT_TILE * TILE_SIZE, 0);
+        highlight.setFillColor(color::AVAILABLE_MOVE);
+        atlas_.draw(highlight);
+        atlas_.display();
+    }
 
-    std::vector<sf::RectangleShape> boardSquares_;
+    void AddQuad(sf::Vector2f position, float size, int tile, float inset = 0) {
+        sf::Vector2f tex(tile * TILE_SIZE + inset, inset);
+        float texSize = TILE_SIZE - 2 * inset;
+        const sf::Vector2f corners[] = {{0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1}};
+        for (auto corner : corners) {
+            vertices_.append(sf::Vertex(
+                {position.x + corner.x * size, position.y + corner.y * size},
+                {tex.x + corner.x * texSize, tex.y + corner.y * texSize}));
+        }
+    }
+
+    void BuildVertices() {
+        vertices_.clear();
+        for (int cellId = 0; cellId < static_cast<int>(highlightedCells_.size()); ++cellId) {
+            if (highlightedCells_[cellId]) {
+                sf::Vector2f position((cellId % numCols_) * CELL_SIZE, (cellId / numCols_) * CELL_SIZE);
+                // Sample the middle of the tile, its border may blend with the neighbours.
+                AddQuad(position, CELL_SIZE, HIGHLIGHT_TILE, TILE_SIZE / 4);
+            }
+        }
+        for (const auto& piece : pieces_) {
+            if (piece.cellId != -1) {
+                auto position = ToVector(piece.cellId, numCols_) - sf::Vector2f(OUTLINE, OUTLINE);
+                AddQuad(position, TILE_SIZE, TileOf(piece));
+            }
+        }
+    }
+
+    sf::RenderTarget& target_;
+    sf::ContextSettings settings_;
 
     sf::Sprite sprite_;
     sf::Texture texture_;
-    std::unordered_set<int> squaresToDraw_;
+    sf::RenderTexture atlas_;
+    sf::VertexArray vertices_{sf::Triangles};
+    bool dirty_ = true;
 
-    std::vector<sf::CircleShape> pieces_;
+    std::vector<bool> highlightedCells_;
+    std::vector<PieceSprite> pieces_;
+
+    Hud hud_;
+    bool hudVisible_ = false;
+    int drawCalls_ = 0;
 
     int numCols_ = -1;
 };
 
+// The side to move lost.
 class OutOfMovesError : public std::runtime_error {
 public:
     OutOfMovesError() : std::runtime_error("Lost!") {}
+
+protected:
+    explicit OutOfMovesError(const std::string& what) : std::runtime_error(what) {}
+};
+
+class TimeForfeitError : public OutOfMovesError {
+public:
+    TimeForfeitError() : OutOfMovesError("Lost on time!") {}
 };
 
 class DrawError : public std::runtime_error {
@@ -219,6 +483,8 @@ public:
 };
 
 class GameManager {
+    friend struct EngineBenchmarks;
+
 public:
     GameManager(size_t numRows, size_t numCols, Renderer& renderer)
         : size_(numRows * numCols), numRows_(numRows), numCols_(numCols), numBlackPieces_(12),
@@ -228,6 +494,22 @@ public:
         allPieces_.reserve(24);
     }
 
+    // A deep copy drawn by another renderer, e.g. a snapshot for a bot thinking on another thread.
+    GameManager(const GameManager& other, Renderer& renderer)
+        : size_(other.size_), numRows_(other.numRows_), numCols_(other.numCols_),
+          numBlackPieces_(other.numBlackPieces_), allPieces_(other.allPieces_),
+          whitePieces_(other.whitePieces_), blackPieces_(other.blackPieces_), renderer_(renderer),
+          board_(other.board_), whitesTurn_(other.whitesTurn_), mustJumpFrom_(other.mustJumpFrom_),
+          eaten_(other.eaten_), availablePieces_(other.availablePieces_),
+          selectedPiece_(other.selectedPiece_), transitions_(other.transitions_),
+          turnsUntilDraw_(other.turnsUntilDraw_), position_(other.position_),
+          clicksPrepared_(other.clicksPrepared_) {
+        paths_.reserve(other.paths_.size());
+        for (const auto& path : other.paths_) {
+            paths_.push_back(ClonePath(path));
+        }
+    }
+
     void InitBoard(
         const std::string& boardFilename = "",
         std::vector<Piece> whitePieces = {},
@@ -273,10 +555,34 @@ public:
         renderer_.InitBoard(boardFilename, whitePieces, blackPieces, numRows_, numCols_);
     }
 
+    // Builds the path trees of the turn and highlights the pieces that can move, the first time it
+    // is called in a turn. Returns whether it did.
+    bool PrepareClicks() {
+        if (clicksPrepared_) {
+            return false;
+        }
+        clicksPrepared_ = true;
+        CalculateMoves();
+        renderer_.HighlightPieces(availablePieces_);
+        for (auto pieceId : availablePieces_) {
+            transitions_[allPieces_.at(pieceId).cellId] = ClickHandler::PIECE;
+        }
+        return true;
+    }
+
     void ProcessClick(int cellId) {
-        if (transitions_.contains(cellId)) {
-            auto handler = transitions_.at(cellId);
-            handler(cellId);
+        PrepareClicks();
+        auto it = transitions_.find(cellId);
+        if (it == transitions_.end()) {
+            return;
+        }
+        switch (it->second) {
+            case ClickHandler::PIECE:
+                ClickHighlightedPiece(cellId);
+                break;
+            case ClickHandler::CELL:
+                ClickHighlightedCell(cellId);
+                break;
         }
     }
 
@@ -284,59 +590,83 @@ public:
         Turn();
     }
 
-    bool IsWhitesTurn() const {
-        return whitesTurn_;
-    }
-
-    bool IsLastLine(int cellId) const {
-        return (whitesTurn_ && cellId / numCols_ == 0) ||
-            (!whitesTurn_ && cellId / numCols_ == numRows_ - 1);
-    }
-
-    class State {
-    public:
-        explicit State(const GameManager& game) : game_(game) {
-        }
-
-        const auto& GetPaths() const {
-            return game_.paths_;
+    // Plays a whole move in one call, without the click handling and the highlights. The move has
+    // to be one of GetPosition().Moves().
+    void ApplyMove(const Move& move) {
+        PROFILE_SCOPE("GameManager::ApplyMove");
+        if (mustJumpFrom_ != -1) {
+            throw std::runtime_error("A capture is being clicked");
         }
-
-        const auto& GetBoard() const {
-            return game_.board_;
+        auto moves = position_.Moves();
+        if (std::find(moves.begin(), moves.end(), move) == moves.end()) {
+            throw std::runtime_error("Illegal move");
         }
-
-        bool IsWhite(int pieceId) const {
-            return game_.IsWhite(pieceId);
+        if (clicksPrepared_) {
+            ClearClicks();
         }
 
-        bool IsEnemy(int cellId) const {
-            return game_.IsEnemy(cellId);
+        const auto pieceId = RemovePiece(move.From());
+        auto& piece = allPieces_[pieceId];
+        const bool wasQueen = piece.isQueen;
+        for (size_t i = 1; i < move.size; ++i) {
+            if (move.IsCapture() && i % 2 == 1) {
+                RemovePiece(move.cells[i]);
+            } else if (IsLastLine(move.cells[i]) && !piece.isQueen) {
+                piece.isQueen = true;
+                if (whitesTurn_) {
+                    renderer_.SetWhitesQueen(pieceId);
+                } else {
+                    renderer_.SetBlacksQueen(pieceId);
+                }
+            }
         }
+        AddPiece(move.To(), pieceId);
 
-        bool IsQueen(int pieceId) const {
-            return game_.allPieces_.at(pieceId).isQueen;
+        if (!move.IsCapture() && wasQueen) {
+            --turnsUntilDraw_;
+            if (turnsUntilDraw_ == 0) {
+                throw DrawError();
+            }
+        } else {
+            turnsUntilDraw_ = TURNS_UNTIL_DRAW;
         }
 
-        bool IsLastLine(int cellId) const {
-            return game_.IsLastLine(cellId);
-        }
+        ChangePlayer();
+        Turn();
+    }
 
-        int GetNumCols() const {
-            return game_.numCols_;
-        }
+    bool IsWhitesTurn() const {
+        return whitesTurn_;
+    }
 
-    private:
-        const GameManager& game_;
-    };
+    bool IsLastLine(int cellId) const {
+        return (whitesTurn_ && cellId / numCols_ == 0) ||
+            (!whitesTurn_ && cellId / numCols_ == numRows_ - 1);
+    }
 
-    std::unique_ptr<State> GetState() const {
-        return std::make_unique<State>(*this);
+    // The position at the start of the current turn, also between the clicks of a capture.
+    const Position& GetPosition() const {
+        return position_;
     }
 
 protected:
+    static std::unique_ptr<PathNode> ClonePath(const std::unique_ptr<PathNode>& node) {
+        if (!node) {
+            return nullptr;
+        }
+        auto copy = std::make_unique<PathNode>(node->cellId);
+        copy->isEmptyCell = node->isEmptyCell;
+        copy->children.reserve(node->children.size());
+        for (const auto& child : node->children) {
+            copy->children.push_back(ClonePath(child));
+        }
+        return copy;
+    }
+
     // Builds path trees from all available pieces and sets availablePieces_.
     void CalculateMoves() {
+        PROFILE_SCOPE("GameManager::CalculateMoves");
+        ALLOC_SCOPE("GameManager::CalculateMoves");
         auto& pieces = GetPlayerPieces();
 
         CalcJumps(pieces);
@@ -381,6 +711,7 @@ protected:
     }
 
     void CalcJumps(const std::unordered_set<int>& pieces) {
+        PROFILE_SCOPE("GameManager::CalcJumps");
         std::unordered_set<int> eaten;
         for (auto pieceId : pieces) {
             int maxSteps = 2;
@@ -483,6 +814,7 @@ protected:
     }
 
     void MakeMove(int to) {
+        PROFILE_SCOPE("GameManager::MakeMove");
         const auto from = selectedPiece_.cellId;
 
         const auto pieceId = RemovePiece(from);
@@ -588,14 +920,10 @@ protected:
         for (auto& move : paths_.at(cellId)->children) {
             if (!move->isEmptyCell) {
                 for (auto& jump : move->children) {
-                    transitions_[jump->cellId] = [this](int cellId) {
-                        ClickHighlightedCell(cellId);
-                    };
+                    transitions_[jump->cellId] = ClickHandler::CELL;
                 }
             } else {
-                transitions_[move->cellId] = [this](int cellId) {
-                    ClickHighlightedCell(cellId);
-                };
+                transitions_[move->cellId] = ClickHandler::CELL;
             }
         }
     }
@@ -623,14 +951,42 @@ protected:
         return pieceId >= numBlackPieces_;
     }
 
+    Position ToPosition() const {
+        assert(numRows_ == Position::NUM_ROWS && numCols_ == Position::NUM_COLS);
+        Position position;
+        for (int cellId = 0; cellId < size_; ++cellId) {
+            auto pieceId = board_[cellId];
+            if (pieceId >= 0) {
+                position.Put(cellId, IsWhite(pieceId), allPieces_.at(pieceId).isQueen);
+            }
+        }
+        position.whitesTurn = whitesTurn_;
+        position.turnsUntilDraw = turnsUntilDraw_;
+        return position;
+    }
+
+    // Path trees and highlights are only built for players that click, see PrepareClicks.
     void Turn() {
-        CalculateMoves();
-        renderer_.HighlightPieces(availablePieces_);
+        position_ = ToPosition();
+        clicksPrepared_ = false;
+        if (position_.Moves().Empty()) {
+            throw OutOfMovesError();
+        }
+    }
+
+    // Drops the path trees and the highlights of a turn that is played by ApplyMove after all.
+    void ClearClicks() {
+        renderer_.RemoveHighlightFromPieces(availablePieces_);
+        if (selectedPiece_.cellId != -1) {
+            renderer_.RemoveHighlightFromMoves(paths_.at(selectedPiece_.cellId));
+            selectedPiece_.cellId = -1;
+        }
         for (auto pieceId : availablePieces_) {
-            transitions_[allPieces_.at(pieceId).cellId] = [this](int cellId) {
-                ClickHighlightedPiece(cellId);
-            };
+            paths_.at(allPieces_.at(pieceId).cellId)->children.clear();
         }
+        availablePieces_.clear();
+        transitions_.clear();
+        clicksPrepared_ = false;
     }
 
     static inline constexpr auto FORWARD = {-9, -7};
@@ -655,12 +1011,17 @@ protected:
     std::vector<std::unique_ptr<PathNode>> paths_;
     std::unordered_set<int> availablePieces_;
     Piece selectedPiece_;
-    using ClickHandler = std::function<void(int cellId)>;
+    // Plain data, so that a copy of the game keeps working.
+    enum class ClickHandler {
+        PIECE,
+        CELL,
+    };
     std::unordered_map<int, ClickHandler> transitions_;
 
-    static constexpr int NUM_PLAYERS = 2;
-    static constexpr int TURNS_UNTIL_DRAW = 15 * NUM_PLAYERS;
+    static constexpr int TURNS_UNTIL_DRAW = Position::TURNS_UNTIL_DRAW;
     int turnsUntilDraw_ = TURNS_UNTIL_DRAW;
+    Position position_;
+    bool clicksPrepared_ = false;
 };
 
 class Events {
@@ -668,52 +1029,212 @@ public:
     Events(sf::Window& window) : window_(window) {
     }
 
+    // Takes a pending event without blocking. Returns false once the window is closed.
     bool Poll() {
-        if (window_.pollEvent(event_)) {
+        tookEvent_ = window_.pollEvent(event_);
+        if (tookEvent_) {
             polled_ = true;
-            if (event_.type == sf::Event::Closed) {
-                window_.close();
-                return false;
-            }
+            return Handle();
         }
         return true;
     }
 
+    // Whether the last Poll took an event, so more may be queued.
+    bool TookEvent() const {
+        return tookEvent_;
+    }
+
+    // Blocks until there is an event. Returns false if the window got closed or, with a wake
+    // period set, if no event came within it.
     bool WaitEvent(sf::Event& event) {
-        while (!polled_) {
-            if (!Poll()) {
+        if (!polled_) {
+            if (wakePeriod_ == sf::Time::Zero) {
+                if (!window_.waitEvent(event_)) {
+                    return false;
+                }
+            } else if (!PollFor(wakePeriod_)) {
+                return false;
+            }
+            polled_ = true;
+            if (!Handle()) {
                 return false;
             }
-            sf::sleep(sf::milliseconds(30));
         }
         event = event_;
         polled_ = false;
         return true;
     }
 
+    // Lets WaitEvent return every `period` without an event, so the caller can refresh what
+    // changes on its own, like the HUD. Zero blocks until an event.
+    void SetWakePeriod(sf::Time period) {
+        wakePeriod_ = period;
+    }
+
+    // Whether the window has to be redrawn although the board did not change.
+    bool TakeRedraw() {
+        return std::exchange(redraw_, false);
+    }
+
+    // Whether the HUD key was pressed since the last call.
+    bool TakeHudToggle() {
+        return std::exchange(hudToggle_, false);
+    }
+
+    // Time since the last click that was not shown yet.
+    std::optional<sf::Time> TakeClickLatency() {
+        if (!clickPending_) {
+            return std::nullopt;
+        }
+        clickPending_ = false;
+        return sinceClick_.getElapsedTime();
+    }
+
 private:
+    // SFML cannot wait for an event with a timeout, so this polls.
+    bool PollFor(sf::Time period) {
+        static const sf::Time POLL_PERIOD = sf::milliseconds(10);
+        sf::Clock clock;
+        while (!window_.pollEvent(event_)) {
+            if (clock.getElapsedTime() >= period) {
+                return false;
+            }
+            sf::sleep(POLL_PERIOD);
+        }
+        return true;
+    }
+
+    bool Handle() {
+        if (event_.type == sf::Event::Closed) {
+            window_.close();
+            return false;
+        }
+        if (event_.type == sf::Event::Resized || event_.type == sf::Event::GainedFocus) {
+            redraw_ = true;
+        } else if (event_.type == sf::Event::MouseButtonPressed) {
+            sinceClick_.restart();
+            clickPending_ = true;
+        } else if (event_.type == sf::Event::KeyPressed && event_.key.code == HUD_KEY) {
+            hudToggle_ = true;
+        }
+        return true;
+    }
+
     sf::Window& window_;
     sf::Event event_;
     bool polled_ = false;
+    bool tookEvent_ = false;
+    sf::Time wakePeriod_ = sf::Time::Zero;
+    bool redraw_ = true;
+    sf::Clock sinceClick_;
+    bool clickPending_ = false;
+    bool hudToggle_ = false;
+
+    static constexpr auto HUD_KEY = sf::Keyboard::F3;
+};
+
+// Logs the frame rate, CPU usage of the process and the mean and worst click-to-frame latency.
+class FrameStats {
+public:
+    void OnFrame(std::optional<sf::Time> clickLatency) {
+        ++frames_;
+        if (clickLatency) {
+            maxLatency_ = std::max(maxLatency_, *clickLatency);
+            totalLatency_ += *clickLatency;
+            ++clicks_;
+        }
+        auto elapsed = clock_.getElapsedTime();
+        if (elapsed < REPORT_PERIOD) {
+            return;
+        }
+        auto cpu = std::clock();
+        Log() << "frames/sec " << frames_ / elapsed.asSeconds()
+              << ", cpu " << 100.0 * (cpu - cpu_) / CLOCKS_PER_SEC / elapsed.asSeconds() << "%"
+              << ", click-to-frame mean " << (clicks_ == 0 ? 0 : totalLatency_.asSeconds() * 1000 / clicks_)
+              << " ms, max " << maxLatency_.asSeconds() * 1000 << " ms";
+        clock_.restart();
+        cpu_ = cpu;
+        frames_ = 0;
+        clicks_ = 0;
+        maxLatency_ = sf::Time::Zero;
+        totalLatency_ = sf::Time::Zero;
+    }
+
+private:
+    inline static const sf::Time REPORT_PERIOD = sf::seconds(5);
+
+    sf::Clock clock_;
+    std::clock_t cpu_ = std::clock();
+    size_t frames_ = 0;
+    size_t clicks_ = 0;
+    sf::Time maxLatency_;
+    sf::Time totalLatency_;
+};
+
+// Counters the bots publish for the HUD, written from any thread.
+struct EngineStats {
+    std::atomic<std::uint64_t> evaluations = 0;
+    // Time the last bot move took to come back from its thread.
+    std::atomic<float> thinkMs = 0;
+    // The last bot's evaluation of the position it moved to, from the whites' point of view.
+    std::atomic<float> eval = 0;
 };
 
+EngineStats& Stats() {
+    static EngineStats stats;
+    return stats;
+}
+
 class Player {
 public:
     virtual ~Player() = default;
 
-    virtual int Turn(std::unique_ptr<GameManager::State> state) = 0;
+    // Returns the move to play or nothing if it is not decided yet.
+    virtual std::optional<Move> Turn(const Position& position) = 0;
+
+    // Asks a Turn running on another thread to return as soon as possible.
+    virtual void Cancel() {
+    }
+
+    // Called with positions the player may face next, so it can prepare its answer while the
+    // opponent thinks. Returns soon once `stop` is set.
+    virtual void Ponder(const Position&, const std::atomic<bool>&) {
+    }
+
+    // Called by a Controller with the opponent's position while the opponent thinks. Players that
+    // can think meanwhile, i.e. AsyncPlayer, ponder over the replies, the rest would only block
+    // the game.
+    virtual void OpponentThinks(const Position&) {
+    }
+
+    // Limits the following Turns. A Controller calls it before every move with the limits of
+    // AllocateTime, the default ignores them.
+    virtual void Limit(const MoveLimits&) {
+    }
+};
+
+// A player that moves by clicking the board, through GameManager's click handling with the moves
+// highlighted.
+class ClickPlayer : public Player {
+public:
+    // Returns the clicked cell or -1 if there is no click yet.
+    virtual int Click() = 0;
+
+    std::optional<Move> Turn(const Position&) final {
+        return std::nullopt;
+    }
 };
 
-class Human : public Player {
+class Human : public ClickPlayer {
 public:
     explicit Human(Events& events) : events_(events) {
     }
 
-    int Turn(std::unique_ptr<GameManager::State> state) override {
+    int Click() override {
         sf::Event event{};
         if (events_.WaitEvent(event)) {
             if (event.type == sf::Event::MouseButtonPressed) {
-                return ToCellId(event.mouseButton.x, event.mouseButton.y, state->GetNumCols());
+                return ToCellId(event.mouseButton.x, event.mouseButton.y, Position::NUM_COLS);
             }
         }
         return -1;
@@ -723,38 +1244,50 @@ private:
     Events& events_;
 };
 
+// Drops the captured cells from a path, leaving the cells a player clicks.
+std::vector<int> ToClicks(std::vector<int> path) {
+    for (size_t i = 1; i + 1 < path.size(); ++i) {
+        path.erase(path.begin() + i);
+    }
+    return path;
+}
+
 class SimpleBot : public Player {
 public:
     explicit SimpleBot() = default;
 
-    int Turn(std::unique_ptr<GameManager::State> state) override {
-        sf::sleep(sf::milliseconds(300));
-        static int turnFrom = -1;
-        const auto& paths = state->GetPaths();
-        for (const auto& from : paths) {
-            if (!from->children.empty()) {
-                if (turnFrom == -1) {
-                    turnFrom = from->cellId;
-                    return turnFrom;
-                }
-                turnFrom = -1;
-                const auto& child = from->children.at(0);
-                if (child->isEmptyCell) {
-                    return child->cellId;
-                }
-                return child->children.at(0)->cellId;
-            }
+    void Limit(const MoveLimits& limits) override {
+        limits_ = limits;
+    }
+
+    // Pauses for a human to follow, shorter if the target comes first. A node budget is for
+    // headless matches, there is no pause then.
+    std::optional<Move> Turn(const Position& position) override {
+        if (limits_.nodes == 0) {
+            auto now = TimeControl::Clock::now();
+            auto pause = std::min<TimeControl::Clock::duration>(PAUSE, limits_.target - std::min(limits_.target, now));
+            std::this_thread::sleep_for(pause);
         }
-        return -1;
+        auto moves = position.Moves();
+        if (moves.Empty()) {
+            return std::nullopt;
+        }
+        return moves[0];
     }
+
+private:
+    static constexpr std::chrono::milliseconds PAUSE{300};
+
+    MoveLimits limits_;
 };
 
-class Simulator : public Player {
+// Replays the clicks of a log, including a human's reselections and stray clicks.
+class Simulator : public ClickPlayer {
 public:
     explicit Simulator(std::vector<int> turns) : turns_(std::move(turns)) {
     }
 
-    int Turn(std::unique_ptr<GameManager::State>) override {
+    int Click() override {
         sf::sleep(sf::milliseconds(30));
         return turns_[ind_++];
     }
@@ -764,153 +1297,600 @@ private:
     size_t ind_ = 0;
 };
 
+std::vector<std::vector<float>> ToInput(const BoardCodes& codes) {
+    std::vector<std::vector<float>> input(codes.size(), std::vector<float>(INPUT_DIM, 0));
+    for (size_t row = 0; row < codes.size(); ++row) {
+        input[row][codes[row]] = 1;
+    }
+    return input;
+}
+
 class AiBot : public Player {
+    friend struct EngineBenchmarks;
+
 public:
     explicit AiBot(std::shared_ptr<Module> nn) : nn_(std::move(nn)) {
     }
 
-    int Turn(std::unique_ptr<GameManager::State> state) override {
-        if (turns_.empty()) {
-            CalcTurns(state);
-        }
-        if (turns_.empty()) {
-            throw OutOfMovesError();
-        }
-        auto turn = turns_.front();
-        turns_.erase(turns_.begin());
-        return turn;
+    explicit AiBot(std::shared_ptr<const ValueNet> valueNet) : valueNet_(std::move(valueNet)) {
     }
 
-private:
-    void CalcTurns(const std::unique_ptr<GameManager::State>& state) {
-        static const std::vector<float> FREE = {1, 0, 0, 0, 0};
-        static const std::vector<float> WHITE = {0, 1, 0, 0, 0};
-        static const std::vector<float> WHITE_QUEEN = {0, 0, 1, 0, 0};
-        static const std::vector<float> BLACK = {0, 0, 0, 1, 0};
-        static const std::vector<float> BLACK_QUEEN = {0, 0, 0, 0, 1};
-
-        const auto& board = state->GetBoard();
-        std::vector<std::vector<float>> input;
-        input.reserve(board.size() / 2);
-        for (auto [i, pieceId] : Enumerate(board)) {
-            if (pieceId != -2) {
-                if (pieceId == -1) {
-                    input.push_back(FREE);
-                } else if (state->IsWhite(pieceId)) {
-                    if (state->IsQueen(pieceId)) {
-                        input.push_back(WHITE_QUEEN);
-                    } else {
-                        input.push_back(WHITE);
-                    }
-                } else {
-                    if (state->IsQueen(pieceId)) {
-                        input.push_back(BLACK_QUEEN);
-                    } else {
-                        input.push_back(BLACK);
-                    }
-                }
-            }
-        }
+    void Cancel() override {
+        cancelled_ = true;
+    }
 
-        std::vector<int> path;
-        auto max = std::numeric_limits<float>::lowest();
-        for (const auto& from : state->GetPaths()) {
-            auto pieceId = board.at(from->cellId);
-            if (pieceId >= 0 && !state->IsEnemy(from->cellId)) {
-                LeavesTraverse(from, path, [&]() {
-                    if (path.size() > 1) {
-                        auto after = input;
-                        after[path.front() / 2] = FREE;
-                        for (size_t i = 1; i + 1 < path.size(); i += 2) {
-                            after[path[i] / 2] = FREE;
-                        }
-                        bool isQueen = state->IsQueen(pieceId);
-                        if (!isQueen) {
-                            for (int cellId : path) {
-                                if (state->IsLastLine(cellId)) {
-                                    isQueen = true;
-                                    break;
-                                }
-                            }
-                        }
-                        if (state->IsWhite(pieceId)) {
-                            if (isQueen) {
-                                after[path.back() / 2] = WHITE_QUEEN;
-                            } else {
-                                after[path.back() / 2] = WHITE;
-                            }
-                        } else {
-                            if (isQueen) {
-                                after[path.back() / 2] = BLACK_QUEEN;
-                            } else {
-                                after[path.back() / 2] = BLACK;
-                            }
-                        }
+    // Plays a uniformly random move with the given probability.
+    void SetExploration(double epsilon, std::uint64_t seed) {
+        epsilon_ = epsilon;
+        rng_ = Philox(seed);
+    }
 
-                        auto matrix = CreateMatrixFromData(after);
-                        nn_->AdjustShape(matrix);
-                        float prob = nn_->Forward(matrix)[0];
-                        if (prob > max) {
-                            max = prob;
-                            turns_ = path;
-                        }
-                    }
-                });
-            }
-        }
+    // Boards any bot with the same netId scored before are not evaluated again. The id stands for
+    // this bot's weights, see EvalCache::NewNetworkId.
+    void SetEvalCache(std::shared_ptr<EvalCache> cache, std::uint32_t netId) {
+        evalCache_ = std::move(cache);
+        netId_ = netId;
+    }
 
-        for (size_t i = 1; i + 1 < turns_.size(); ++i) {
-            turns_.erase(turns_.begin() + i);
-        }
+    // Positions scored by this bot so far, cache hits included.
+    std::uint64_t NumEvaluations() const {
+        return evaluations_;
     }
 
-    template <class Callback>
-    void LeavesTraverse(const std::unique_ptr<PathNode>& cur, std::vector<int>& path, Callback cb) {
-        path.push_back(cur->cellId);
-        if (cur->children.empty()) {
-            cb();
-            path.pop_back();
-            return;
+    // The net's value of the position for the whites, as the bot sees it. Only for ValueNet or
+    // canonical bots: the evolved Sequential scores positions for its own color, which a bot
+    // does not know outside of its Turn, so it throws for those.
+    float WhitesValue(const Position& position) const {
+        if (canonical_) {
+            auto value = Cached(position.Canonical());
+            return position.whitesTurn ? value : -value;
         }
-        for (const auto& child : cur->children) {
-            LeavesTraverse(child, path, cb);
+        if (!valueNet_) {
+            throw std::runtime_error("WhitesValue needs a ValueNet or a canonical bot");
         }
-        path.pop_back();
+        return Cached(position);
     }
 
-    std::vector<int> turns_;
-    std::shared_ptr<Module> nn_;
-};
+    // The net sees Position::Canonical and scores it for the side to move, so one net plays both
+    // colours and mirrored positions share their cache entries. Nets trained on canonical
+    // datasets play this way.
+    void SetCanonical(bool canonical) {
+        canonical_ = canonical;
+    }
 
-class Controller {
-public:
-    Controller(GameManager& game, std::shared_ptr<Player> white, std::shared_ptr<Player> black)
-        : game_(game), whitePlayer_(std::move(white)), blackPlayer_(std::move(black)) {
+    // A node is a move scored. The sweep stops at the node budget or the deadline and plays the
+    // best move so far.
+    void Limit(const MoveLimits& limits) override {
+        limits_ = limits;
     }
 
-    void NextMove() {
-        int cellId;
-        if (game_.IsWhitesTurn()) {
-            cellId = whitePlayer_->Turn(game_.GetState());
-            if (cellId != -1) Log() << "(whites," << cellId << ")";
-        } else {
-            cellId = blackPlayer_->Turn(game_.GetState());
-            if (cellId != -1) Log() << "(blacks," << cellId << ")";
+    std::optional<Move> Turn(const Position& position) override {
+        auto it = pondered_.find(position);
+        auto choice = it != pondered_.end() ? it->second : CalcTurns(position, limits_);
+        pondered_.clear();
+        Stats().eval = position.whitesTurn ? choice.value : -choice.value;
+        if (!choice.move) {
+            throw OutOfMovesError();
         }
-        if (cellId == -1) {
-            return;
+        return choice.move;
+    }
+
+    // Not under a node budget, the answers would come from full sweeps.
+    void Ponder(const Position& position, const std::atomic<bool>&) override {
+        if (limits_.nodes == 0 && !pondered_.contains(position)) {
+            pondered_.emplace(position, CalcTurns(position));
         }
-        game_.ProcessClick(cellId);
     }
 
 private:
-    GameManager& game_;
-    std::shared_ptr<Player> whitePlayer_;
-    std::shared_ptr<Player> blackPlayer_;
-};
+    struct Choice {
+        std::optional<Move> move;
+        // Of the best move, for the side to move.
+        float value = 0;
+    };
 
-// template <class SecondPlayer>
-// std::unique_ptr<Controller> PlayWith(GameManager& game, Events& events) {
+    Choice CalcTurns(const Position& position, const MoveLimits& limits = {}) {
+        PROFILE_SCOPE("AiBot::CalcTurns");
+        ALLOC_SCOPE("AiBot::CalcTurns");
+        std::optional<Move> best;
+        std::optional<Move> random;
+        size_t numLeaves = 0;
+        auto max = std::numeric_limits<float>::lowest();
+        for (const auto& move : position.Moves()) {
+            if (cancelled_.load(std::memory_order_relaxed)) {
+                return {};
+            }
+            if (best && ((limits.nodes > 0 && numLeaves >= limits.nodes) ||
+                         (limits.Timed() && TimeControl::Clock::now() >= limits.deadline))) {
+                break;
+            }
+            float prob = Evaluate(position.After(move), position.whitesTurn);
+            if (prob > max) {
+                max = prob;
+                best = move;
+            }
+            ++numLeaves;
+            if (epsilon_ > 0 && rng_.Below(numLeaves) == 0) {
+                random = move;
+            }
+        }
+        PROFILE_COUNT("AiBot::leaves", numLeaves);
+        Stats().evaluations.fetch_add(numLeaves, std::memory_order_relaxed);
+        evaluations_ += numLeaves;
+        if (epsilon_ > 0 && rng_.Uniform() < epsilon_) {
+            best = random;
+        }
+        return {best, max};
+    }
+
+    // The evolved Sequential scores positions for its own color, ValueNet always for the whites.
+    float Evaluate(const Position& position, bool white) const {
+        PROFILE_SCOPE("AiBot::Evaluate");
+        if (canonical_) {
+            // For the side to move, the opponent of `white`.
+            return -Cached(position.Canonical());
+        }
+        auto value = Cached(position);
+        if (valueNet_) {
+            return white ? value : -value;
+        }
+        return value;
+    }
+
+    float Cached(const Position& position) const {
+        if (!evalCache_) {
+            return Forward(position);
+        }
+        return evalCache_->GetOrEvaluate(position, netId_, [&]() { return Forward(position); });
+    }
+
+    float Forward(const Position& position) const {
+        auto codes = position.Encode();
+        if (valueNet_) {
+            return valueNet_->Forward(codes);
+        }
+        auto matrix = CreateMatrixFromData(ToInput(codes));
+        nn_->AdjustShape(matrix);
+        return nn_->Forward(matrix)[0];
+    }
+
+    // Answers prepared on the opponent's time, dropped after every move.
+    std::map<Position, Choice> pondered_;
+    std::shared_ptr<Module> nn_;
+    std::shared_ptr<const ValueNet> valueNet_;
+    std::shared_ptr<EvalCache> evalCache_;
+    std::uint32_t netId_ = 0;
+    bool canonical_ = false;
+    MoveLimits limits_;
+    std::uint64_t evaluations_ = 0;
+    double epsilon_ = 0;
+    Philox rng_;
+    std::atomic<bool> cancelled_ = false;
+};
+
+// Searches with PUCT instead of AiBot's single ply, see MctsTree, and keeps the subtree of the
+// position it gets next. Playouts run on config.numThreads threads: the calling one and a pool. A
+// ValueNet is evaluated from all of them at once, a Sequential keeps buffers in its modules and
+// is evaluated by one thread at a time.
+class MctsBot : public Player {
+public:
+    explicit MctsBot(std::shared_ptr<Module> nn, MctsConfig config = {})
+        : nn_(std::move(nn)), config_(config), pool_(config.numThreads - 1),
+          tree_(config, [this](const Position& position) { return Evaluate(position); }) {
+    }
+
+    explicit MctsBot(std::shared_ptr<const ValueNet> valueNet, MctsConfig config = {})
+        : valueNet_(std::move(valueNet)), config_(config), pool_(config.numThreads - 1),
+          tree_(config, [this](const Position& position) { return Evaluate(position); }) {
+    }
+
+    void Cancel() override {
+        cancelled_ = true;
+    }
+
+    // As AiBot::SetEvalCache. Call while no search runs.
+    void SetEvalCache(std::shared_ptr<EvalCache> cache, std::uint32_t netId) {
+        evalCache_ = std::move(cache);
+        netId_ = netId;
+    }
+
+    // As AiBot::SetCanonical. Call while no search runs.
+    void SetCanonical(bool canonical) {
+        canonical_ = canonical;
+    }
+
+    void Limit(const MoveLimits& limits) override {
+        limits_ = limits;
+    }
+
+    std::optional<Move> Turn(const Position& position) override {
+        auto result = Think(position, limits_, cancelled_);
+        if (!result.move) {
+            throw OutOfMovesError();
+        }
+        return result.move;
+    }
+
+    struct Result {
+        std::optional<Move> move;
+        // For the side to move.
+        float value = 0;
+        size_t playouts = 0;
+    };
+
+    // Searches limits.nodes playouts, or without a time limit config.playouts. A timed search
+    // goes in slices of a quarter of the time to the target and stops at the first slice end past
+    // the target whose best move is the one of the slice before, or at the deadline: a move that
+    // only just took over has not been looked at much.
+    Result Think(const Position& position, const MoveLimits& limits, const std::atomic<bool>& stop) {
+        static constexpr int NUM_SLICES = 4;
+        static constexpr std::chrono::milliseconds MIN_SLICE{1};
+        size_t playouts = limits.nodes > 0 ? limits.nodes
+                          : limits.Timed() ? std::numeric_limits<size_t>::max()
+                                           : config_.playouts;
+        if (!limits.Timed()) {
+            return Think(position, playouts, MctsTree::Clock::time_point::max(), stop);
+        }
+
+        auto now = MctsTree::Clock::now();
+        auto slice = std::max<MctsTree::Clock::duration>(MIN_SLICE, (std::max(limits.target, now) - now) / NUM_SLICES);
+        auto sliceEnd = now;
+        Result result;
+        while (true) {
+            sliceEnd = std::min(sliceEnd + slice, limits.deadline);
+            auto think = Think(position, playouts - result.playouts, sliceEnd, stop);
+            bool settled = result.move && think.move == result.move;
+            result = {think.move, think.value, result.playouts + think.playouts};
+            now = MctsTree::Clock::now();
+            if (result.playouts >= playouts || stop.load(std::memory_order_relaxed) ||
+                now >= limits.deadline || (now >= limits.target && settled)) {
+                return result;
+            }
+        }
+    }
+
+    // Searches until `playouts` more are done, `deadline` passes or `stop` is set. The move is
+    // empty if there is none.
+    Result Think(const Position& position, size_t playouts, MctsTree::Clock::time_point deadline,
+                 const std::atomic<bool>& stop) {
+        PROFILE_SCOPE("MctsBot::Think");
+        tree_.SetRoot(position);
+        white_ = position.whitesTurn;
+        auto visits = tree_.RootVisits();
+        Search(playouts, deadline, stop);
+        Result result{tree_.BestMove(), tree_.RootValue(), tree_.RootVisits() - visits};
+        if (!result.move) {
+            // Stopped before the root got expanded.
+            auto moves = position.Moves();
+            if (!moves.Empty()) {
+                result.move = moves[0];
+            }
+        }
+        Stats().eval = white_ ? result.value : -result.value;
+        return result;
+    }
+
+    // Searches a move's playouts on the opponent's expected answer to our last move, into the
+    // subtree the next Turn keeps if the answer comes. Other answers are not searched, they would
+    // drop the tree. Like AiBot, it does not ponder under a node budget.
+    void Ponder(const Position& position, const std::atomic<bool>& stop) override {
+        if (limits_.nodes > 0 || tree_.ExpectedPosition(2) != position) {
+            return;
+        }
+        tree_.SetRoot(position);
+        white_ = position.whitesTurn;
+        Search(config_.playouts, MctsTree::Clock::time_point::max(), stop);
+    }
+
+private:
+    // Runs playouts from the root on this thread and the pool's.
+    void Search(size_t playouts, MctsTree::Clock::time_point deadline, const std::atomic<bool>& stop) {
+        auto evaluations = tree_.NumEvaluations();
+        std::atomic<std::int64_t> budget = std::min<size_t>(playouts, std::numeric_limits<std::int64_t>::max());
+        std::vector<std::shared_ptr<Task>> helpers;
+        for (size_t i = 1; i < config_.numThreads; ++i) {
+            helpers.push_back(pool_.AddTask([&]() {
+                tree_.Search(budget, stop, deadline);
+            }));
+        }
+        tree_.Search(budget, stop, deadline);
+        for (auto& helper : helpers) {
+            helper->Wait();
+        }
+        Stats().evaluations.fetch_add(tree_.NumEvaluations() - evaluations, std::memory_order_relaxed);
+    }
+
+    // For the whites, squashed to [-1, 1].
+    float Evaluate(const Position& position) {
+        if (canonical_) {
+            auto value = std::tanh(Cached(position.Canonical()));
+            return position.whitesTurn ? value : -value;
+        }
+        auto value = std::tanh(Cached(position));
+        // The evolved Sequential scores positions for its own color.
+        if (valueNet_ || white_) {
+            return value;
+        }
+        return -value;
+    }
+
+    float Cached(const Position& position) {
+        if (!evalCache_) {
+            return Forward(position);
+        }
+        return evalCache_->GetOrEvaluate(position, netId_, [&]() { return Forward(position); });
+    }
+
+    float Forward(const Position& position) {
+        auto codes = position.Encode();
+        if (valueNet_) {
+            return valueNet_->Forward(codes);
+        }
+        std::unique_lock lock(nnMutex_);
+        auto matrix = CreateMatrixFromData(ToInput(codes));
+        nn_->AdjustShape(matrix);
+        return nn_->Forward(matrix)[0];
+    }
+
+    std::shared_ptr<Module> nn_;
+    std::mutex nnMutex_;
+    std::shared_ptr<const ValueNet> valueNet_;
+    std::shared_ptr<EvalCache> evalCache_;
+    std::uint32_t netId_ = 0;
+    bool canonical_ = false;
+    MoveLimits limits_;
+    MctsConfig config_;
+    ThreadPool pool_;
+    MctsTree tree_;
+    bool white_ = true;
+    std::atomic<bool> cancelled_ = false;
+};
+
+// Runs a player on a worker thread, so the window stays responsive while it thinks. Positions go
+// to the worker and moves come back through lock-free queues.
+// On the opponent's time the worker ponders over every position the opponent can move to.
+class AsyncPlayer : public Player {
+public:
+    explicit AsyncPlayer(std::shared_ptr<Player> player)
+        : player_(std::move(player)), worker_([this]() { Work(); }) {
+    }
+
+    ~AsyncPlayer() override {
+        stop_ = true;
+        stopPondering_ = true;
+        player_->Cancel();
+        ++requestsPushed_;
+        requestsPushed_.notify_one();
+        worker_.join();
+    }
+
+    std::optional<Move> Turn(const Position& position) override {
+        if (auto reply = replies_.Pop()) {
+            thinking_ = false;
+            Stats().thinkMs = thinkClock_.getElapsedTime().asMicroseconds() / 1000.0F;
+            if (reply->error) {
+                std::rethrow_exception(reply->error);
+            }
+            return reply->move;
+        }
+        if (!thinking_) {
+            thinking_ = true;
+            pondering_ = false;
+            stopPondering_ = true;
+            thinkClock_.restart();
+            Send({position, false, limits_});
+        }
+        return std::nullopt;
+    }
+
+    // Once per opponent's turn, any further call until our move is ignored.
+    void OpponentThinks(const Position& position) override {
+        if (!thinking_ && !pondering_) {
+            pondering_ = true;
+            stopPondering_ = false;
+            Send({position, true, {}});
+        }
+    }
+
+    // Goes with the next move request.
+    void Limit(const MoveLimits& limits) override {
+        limits_ = limits;
+    }
+
+private:
+    struct Request {
+        Position position;
+        bool ponder = false;
+        MoveLimits limits;
+    };
+
+    struct Reply {
+        std::optional<Move> move;
+        std::exception_ptr error;
+    };
+
+    void Send(Request request) {
+        requests_.Push(std::move(request));
+        ++requestsPushed_;
+        requestsPushed_.notify_one();
+    }
+
+    void Work() {
+        size_t requestsSeen = 0;
+        while (true) {
+            requestsPushed_.wait(requestsSeen);
+            requestsSeen = requestsPushed_.load();
+            if (stop_) {
+                return;
+            }
+            while (auto request = requests_.Pop()) {
+                if (request->ponder) {
+                    PonderReplies(request->position);
+                    continue;
+                }
+                Reply reply;
+                try {
+                    player_->Limit(request->limits);
+                    reply.move = player_->Turn(request->position);
+                } catch (...) {
+                    reply.error = std::current_exception();
+                }
+                replies_.Push(std::move(reply));
+            }
+        }
+    }
+
+    // Lets the player prepare an answer to every move of the opponent. Gives up as soon as a real
+    // request arrives.
+    void PonderReplies(const Position& position) {
+        for (const auto& move : position.Moves()) {
+            if (stopPondering_) {
+                return;
+            }
+            auto next = position.After(move);
+            if (!next.IsDraw()) {
+                player_->Ponder(next, stopPondering_);
+            }
+        }
+    }
+
+    std::shared_ptr<Player> player_;
+    // At most one move and one ponder request are in flight at a time.
+    SpscQueue<Request, 2> requests_;
+    SpscQueue<Reply, 2> replies_;
+    std::atomic<size_t> requestsPushed_ = 0;
+    std::atomic<bool> stop_ = false;
+    bool thinking_ = false;
+    bool pondering_ = false;
+    // Set with the move request, so the player stops pondering for it.
+    std::atomic<bool> stopPondering_ = false;
+    MoveLimits limits_;
+    sf::Clock thinkClock_;
+    std::thread worker_;
+};
+
+// Asks the players for their moves in turn and runs their clocks. A side whose clock runs out
+// loses with a TimeForfeitError, computer players get their MoveLimits from AllocateTime before
+// every move.
+class Controller {
+public:
+    Controller(GameManager& game, std::shared_ptr<Player> white, std::shared_ptr<Player> black,
+               TimeControl timeControl = {})
+        : game_(game), whitePlayer_(std::move(white)), blackPlayer_(std::move(black)),
+          whiteClicks_(dynamic_cast<ClickPlayer*>(whitePlayer_.get())),
+          blackClicks_(dynamic_cast<ClickPlayer*>(blackPlayer_.get())), clock_(timeControl) {
+    }
+
+    // Returns whether the game changed: a move or a click was played or the moves got highlighted.
+    bool NextMove() {
+        const bool whites = game_.IsWhitesTurn();
+        const auto& position = game_.GetPosition();
+        (whites ? blackPlayer_ : whitePlayer_)->OpponentThinks(position);
+        if (!clock_.Running()) {
+            clock_.Start(whites);
+            (whites ? whitePlayer_ : blackPlayer_)->Limit(
+                AllocateTime(clock_.Control(), clock_.Remaining(whites), ply_));
+        }
+        if (clock_.Flagged(whites)) {
+            throw TimeForfeitError();
+        }
+
+        if (auto* clicks = whites ? whiteClicks_ : blackClicks_) {
+            // Shows the highlights before a human gets to click.
+            if (game_.PrepareClicks()) {
+                return true;
+            }
+            int cellId = clicks->Click();
+            if (cellId == -1) {
+                return false;
+            }
+            // A human may have waited in Click past the flag.
+            if (clock_.Flagged(whites)) {
+                throw TimeForfeitError();
+            }
+            LogClick(whites, cellId);
+            game_.ProcessClick(cellId);
+            if (game_.IsWhitesTurn() != whites) {
+                clock_.Stop();
+                ++ply_;
+            }
+            return true;
+        }
+
+        auto move = (whites ? whitePlayer_ : blackPlayer_)->Turn(position);
+        if (!move) {
+            return false;
+        }
+        if (!clock_.Stop()) {
+            throw TimeForfeitError();
+        }
+        ++ply_;
+        // Logged as the clicks that play it, so logs replay the same either way.
+        for (int cellId : ToClicks(move->Path())) {
+            LogClick(whites, cellId);
+        }
+        game_.ApplyMove(*move);
+        return true;
+    }
+
+    const GameClock& Clock() const {
+        return clock_;
+    }
+
+    // Whether the side to move clicks, then NextMove waits for the clicks itself.
+    bool ClicksToMove() const {
+        return (game_.IsWhitesTurn() ? whiteClicks_ : blackClicks_) != nullptr;
+    }
+
+private:
+    static void LogClick(bool whites, int cellId) {
+        if (whites) {
+            Log() << "(whites," << cellId << ")";
+        } else {
+            Log() << "(blacks," << cellId << ")";
+        }
+    }
+
+    GameManager& game_;
+    std::shared_ptr<Player> whitePlayer_;
+    std::shared_ptr<Player> blackPlayer_;
+    // Set for players that click, nullptr for those that return moves.
+    ClickPlayer* whiteClicks_;
+    ClickPlayer* blackClicks_;
+    GameClock clock_;
+    // Moves played through this controller.
+    int ply_ = 0;
+};
+
+// Plays a headless game to the end or until the adjudicator calls it. onPosition gets every
+// position with the side to move. Returns 0 if the whites won, 1 if the blacks won and 2 on a draw.
+template <class OnPosition>
+int PlayGame(GameManager& game, Controller& controller, OnPosition onPosition, Adjudicator* adjudicator = nullptr) {
+    ALLOC_SCOPE("PlayGame");
+    bool whitesTurn = game.IsWhitesTurn();
+    onPosition(game.GetPosition(), whitesTurn);
+    try {
+        while (true) {
+            if (adjudicator) {
+                if (auto result = adjudicator->Judge(game.GetPosition())) {
+                    return *result;
+                }
+            }
+            do {
+                controller.NextMove();
+            } while (game.IsWhitesTurn() == whitesTurn);
+            whitesTurn = game.IsWhitesTurn();
+            onPosition(game.GetPosition(), whitesTurn);
+        }
+    } catch (const OutOfMovesError&) {
+        return game.IsWhitesTurn() ? 1 : 0;
+    } catch (const DrawError&) {
+        return 2;
+    }
+}
+
+// template <class SecondPlayer>
+// std::unique_ptr<Controller> PlayWith(GameManager& game, Events& events) {
 //     return std::make_unique<Controller>(
 //         game,
 //         std::make_unique<Human>(events),
@@ -925,7 +1905,7 @@ PlayWith(GameManager& game, Events& events, std::unique_ptr<Player> secondPlayer
         std::move(secondPlayer));
 }
 
-auto BuildNeuralNetwork() {
+std::shared_ptr<Sequential> CreateNeuralNetwork() {
     auto nn = std::make_shared<Sequential>();
     (*nn)
         .AddModule(Flatten())
@@ -934,6 +1914,11 @@ auto BuildNeuralNetwork() {
         .AddModule(Linear(32, 16))
         .AddModule(ReLU())
         .AddModule(Linear(16, 1));
+    return nn;
+}
+
+auto BuildNeuralNetwork() {
+    auto nn = CreateNeuralNetwork();
     static int i = 0;
     std::ofstream file("nn" + std::to_string(i));
     nn->Dump(file);
@@ -941,11 +1926,102 @@ auto BuildNeuralNetwork() {
     return nn;
 }
 
+size_t DefaultNumThreads() {
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
+// How School picks the black opponent of every white bot in a round. Every bot plays exactly one
+// game per round, so scores stay comparable whatever the pairing.
+enum class Pairing {
+    // Round r pairs white i with black i + r: numBots rounds, numBots^2 games.
+    RoundRobin,
+    // Bots are paired by their rank in the standings of the previous rounds.
+    Swiss,
+    // Every round is a random permutation of the blacks.
+    Sampled,
+};
+
+struct SchoolConfig {
+    size_t numBots = 4;
+    size_t numThreads = DefaultNumThreads();
+    Pairing pairing = Pairing::RoundRobin;
+    // Games per generation, 0 plays all numBots rounds of the round robin or DEFAULT_ROUNDS otherwise.
+    size_t gamesBudget = 0;
+    Mutation mutation;
+    std::uint64_t seed = 0;
+    // Entries of an EvalCache shared by the games of all generations, 0 for none.
+    size_t evalCacheSize = 0;
+    // Bots evaluate and the dataset stores Position::Canonical, see AiBot::SetCanonical.
+    bool canonical = false;
+    AdjudicationConfig adjudication;
+
+    static constexpr size_t DEFAULT_ROUNDS = 8;
+};
+
+// How the bots of self-play games evaluate positions and when the games end.
+struct SelfPlayOptions {
+    // Shared by all games, the ids of the genomes stand for their weights.
+    std::shared_ptr<EvalCache> cache;
+    // See AiBot::SetCanonical, the recorder stores canonical positions then too.
+    bool canonical = false;
+    AdjudicationConfig adjudication;
+};
+
+struct SelfPlayResult {
+    // As PlayGame returns it.
+    int win = 2;
+    Adjudication adjudication = Adjudication::None;
+    int plies = 0;
+};
+
+// One headless self-play game between two genomes. Every thread builds the two networks in its
+// own buffers, the population holds no full copies.
+SelfPlayResult PlayGenomes(const Genome& white, const Genome& black, const Mutation& mutation,
+                           GameRecorder& recorder, const SelfPlayOptions& options = {},
+                           std::uint32_t whiteId = 0, std::uint32_t blackId = 0) {
+    thread_local auto whiteNet = std::make_shared<ValueNet>();
+    thread_local auto blackNet = std::make_shared<ValueNet>();
+    white.Materialize(*whiteNet, mutation);
+    black.Materialize(*blackNet, mutation);
+
+    EmptyRenderer renderer;
+    GameManager game(8, 8, renderer);
+    game.InitBoard();
+    game.Start();
+    auto whiteBot = std::make_shared<AiBot>(std::shared_ptr<const ValueNet>(whiteNet));
+    auto blackBot = std::make_shared<AiBot>(std::shared_ptr<const ValueNet>(blackNet));
+    if (options.cache) {
+        whiteBot->SetEvalCache(options.cache, whiteId);
+        blackBot->SetEvalCache(options.cache, blackId);
+    }
+    whiteBot->SetCanonical(options.canonical);
+    blackBot->SetCanonical(options.canonical);
+    Controller controller(game, whiteBot, blackBot);
+
+    // Both nets have to see the game won, the weaker opinion counts.
+    Adjudicator adjudicator(options.adjudication, [&](const Position& position) {
+        auto whites = std::tanh(whiteBot->WhitesValue(position));
+        auto blacks = std::tanh(blackBot->WhitesValue(position));
+        if ((whites > 0) != (blacks > 0)) {
+            return 0.0F;
+        }
+        return std::abs(whites) < std::abs(blacks) ? whites : blacks;
+    });
+
+    static constexpr std::int8_t RESULTS[] = {1, -1, 0};
+    auto win = PlayGame(game, controller, [&](const Position& position, bool) {
+        recorder.Record(position);
+    }, &adjudicator);
+    recorder.Finish(RESULTS[win]);
+    return {win, adjudicator.Reason(), adjudicator.Plies()};
+}
+
 class School {
     struct Student {
-        explicit Student(std::shared_ptr<Sequential> bot)
-            : bot(std::move(bot))
-            , mutex(std::make_unique<std::mutex>())
+        explicit Student(Genome genome)
+            : mutex(std::make_unique<std::mutex>())
+            , genome(std::move(genome))
+            , netId(EvalCache::NewNetworkId())
         {}
 
         Student(Student&&) = default;
@@ -956,71 +2032,63 @@ class School {
         }
 
         int score = 0;
+        // Of a white bot, the black bots by index it met since the scores were zeroed.
+        std::vector<bool> played;
+        // Guards the score, games never modify the genome.
         std::unique_ptr<std::mutex> mutex;
-        std::shared_ptr<Sequential> bot;
+        Genome genome;
+        // Of the genome's weights in the eval cache.
+        std::uint32_t netId;
     };
 
 public:
-    explicit School(int numBots)
-        : numBots_(numBots)
-        , bestBlack_(BuildNeuralNetwork())
+    explicit School(SchoolConfig config)
+        : config_(config)
+        , numBots_(config.numBots)
+        , rng_(config.seed)
+        , bestBlack_(Genome{nullptr, NextSeed()})
     {
         for (size_t i = 0; i < numBots_; ++i) {
-            whiteBots_.emplace_back(BuildNeuralNetwork());
-            whiteBots_.back().bot->ApplyNoise();
-            blackBots_.emplace_back(BuildNeuralNetwork());
-            blackBots_.back().bot->ApplyNoise();
+            whiteBots_.emplace_back(Genome{nullptr, NextSeed()});
+            blackBots_.emplace_back(Genome{nullptr, NextSeed()});
+        }
+        if (config_.evalCacheSize > 0) {
+            evalCache_ = std::make_shared<EvalCache>(config_.evalCacheSize);
         }
     }
 
     void Teach() {
-        ThreadPool pool(12);
+        ALLOC_SCOPE_PROCESS("School::Teach");
+        adjudicationStats_.Reset();
+        if (coordinator_) {
+            TeachRemotely();
+            Log() << "Adjudication: " << adjudicationStats_;
+            return;
+        }
+        auto cacheBefore = evalCache_ ? evalCache_->GetCounters() : EvalCache::Counters{};
+        ThreadPool pool(config_.numThreads);
         std::atomic<int> gameInd = 0;
-        for (size_t diff = 0; diff < numBots_; ++diff) {
+        auto numRounds = NumRounds();
+        for (size_t round = 0; round < numRounds; ++round) {
+            if (config_.pairing == Pairing::Swiss) {
+                // The pairing depends on the results of all previous rounds.
+                pool.WaitAll();
+            }
+            auto opponents = PairOpponents(round);
             for (size_t firstInd = 0; firstInd < numBots_; ++firstInd) {
                 pool.AddTask([=, this, &gameInd]() {
-                    auto secondInd = (firstInd + diff) % numBots_;
-                    auto& first = whiteBots_[firstInd];
-                    auto& second = blackBots_[secondInd];
-
-                    std::stringstream ss;
-                    ss << "Game" << gameInd.fetch_add(1);
-                    auto filename = ss.str();
-                    thread_local std::ofstream file(filename);
-                    Log() = Logger(std::move(filename), file);
-
-                    EmptyRenderer renderer;
-                    GameManager game(8, 8, renderer);
-                    game.InitBoard("board_8x8.png");
-                    game.Start();
-
-                    std::unique_lock firstLock(*first.mutex, std::defer_lock);
-                    std::unique_lock secondLock(*second.mutex, std::defer_lock);
-                    std::lock(firstLock, secondLock);
-
-                    auto win = Play(game, Controller(
-                        game,
-                        std::make_shared<AiBot>(first.bot),
-                        std::make_shared<AiBot>(second.bot)));
-
-                    if (win == 4) {
-                        throw std::runtime_error("WFT");
-                    }
-                    if (win == 0) {
-                        first.score += 2;
-                    } else if (win == 1) {
-                        second.score += 2;
-                    } else {
-                        assert(win == 2);
-                        ++first.score;
-                        ++second.score;
-                    }
-
-                    Log() << "won " << win;
+                    PlayMatch(whiteBots_[firstInd], blackBots_[opponents[firstInd]], gameInd.fetch_add(1));
                 });
             }
         }
         pool.WaitAll();
+        Log() << "Played " << gameInd << " games in " << numRounds << " rounds";
+        Log() << "Adjudication: " << adjudicationStats_;
+        if (evalCache_) {
+            auto counters = evalCache_->GetCounters() - cacheBefore;
+            Log() << "Eval cache hit rate " << counters.HitRate() << " over " << counters.lookups << " lookups, "
+                  << counters.evictions << " evictions of " << evalCache_->Capacity() << " entries";
+        }
     }
 
     void Update() {
@@ -1030,125 +2098,602 @@ public:
         Log() << "Best blacks score:" << blackBots_.front().score;
         if (blackBots_.front().score > bestBlack_.score) {
             bestBlack_.score = blackBots_.front().score;
-            bestBlack_.bot = std::make_shared<Sequential>(*blackBots_.front().bot);
+            bestBlack_.genome = blackBots_.front().genome;
+            bestBlack_.netId = blackBots_.front().netId;
         }
         ZeroScore(whiteBots_);
         ZeroScore(blackBots_);
     }
 
+    // Streams every position of the following self-play games to the dataset.
+    void RecordTo(std::shared_ptr<DatasetWriter> dataset) {
+        dataset_ = std::move(dataset);
+    }
+
+    // Plays the following games on the coordinator's workers instead of the local pool.
+    void DistributeTo(std::shared_ptr<distributed::Coordinator> coordinator) {
+        coordinator_ = std::move(coordinator);
+    }
+
     auto GetBest() const {
         Log() << "Best black score: " << bestBlack_.score;
-        return bestBlack_.bot;
+        return bestBlack_.genome.Materialize(config_.mutation);
     }
 
 private:
+    size_t NumRounds() const {
+        size_t maxRounds = config_.pairing == Pairing::RoundRobin ? numBots_ : std::numeric_limits<size_t>::max();
+        if (config_.gamesBudget == 0) {
+            return config_.pairing == Pairing::RoundRobin ? numBots_ : SchoolConfig::DEFAULT_ROUNDS;
+        }
+        return std::clamp<size_t>(config_.gamesBudget / numBots_, 1, maxRounds);
+    }
+
+    // opponents[i] is the black bot to play the white bot i.
+    std::vector<size_t> PairOpponents(size_t round) {
+        std::vector<size_t> opponents(numBots_);
+        for (auto& white : whiteBots_) {
+            white.played.resize(numBots_);
+        }
+        if (config_.pairing == Pairing::RoundRobin) {
+            for (size_t i = 0; i < numBots_; ++i) {
+                opponents[i] = (i + round) % numBots_;
+            }
+            return opponents;
+        }
+
+        std::iota(opponents.begin(), opponents.end(), 0);
+        std::shuffle(opponents.begin(), opponents.end(), rng_);
+        if (config_.pairing == Pairing::Swiss && round > 0) {
+            auto byScore = [](const std::vector<Student>& bots) {
+                std::vector<size_t> order(bots.size());
+                std::iota(order.begin(), order.end(), 0);
+                std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+                    return bots[rhs] < bots[lhs];
+                });
+                return order;
+            };
+            // From the top down each white bot meets the best ranked black bot it has not played
+            // yet. A white bot finding them all taken moves a higher one to its next choice if
+            // that frees one, so as few games as possible are rematches. Those left over take
+            // the best ranked black bots left.
+            auto whites = byScore(whiteBots_);
+            auto blacks = byScore(blackBots_);
+            std::vector<size_t> whiteOf(numBots_, numBots_);
+            std::vector<bool> visited;
+            std::function<bool(size_t)> match = [&](size_t white) {
+                const auto& played = whiteBots_[white].played;
+                for (auto black : blacks) {
+                    if (!played[black] && whiteOf[black] == numBots_) {
+                        whiteOf[black] = white;
+                        return true;
+                    }
+                }
+                for (auto black : blacks) {
+                    if (played[black] || visited[black]) {
+                        continue;
+                    }
+                    visited[black] = true;
+                    if (match(whiteOf[black])) {
+                        whiteOf[black] = white;
+                        return true;
+                    }
+                }
+                return false;
+            };
+            std::vector<size_t> unmatched;
+            for (auto white : whites) {
+                visited.assign(numBots_, false);
+                if (!match(white)) {
+                    unmatched.push_back(white);
+                }
+            }
+            for (auto black : blacks) {
+                if (whiteOf[black] == numBots_) {
+                    whiteOf[black] = unmatched.front();
+                    unmatched.erase(unmatched.begin());
+                }
+                opponents[whiteOf[black]] = black;
+            }
+        }
+        for (size_t i = 0; i < numBots_; ++i) {
+            whiteBots_[i].played[opponents[i]] = true;
+        }
+        return opponents;
+    }
+
+    void PlayMatch(Student& first, Student& second, int gameInd) {
+        std::stringstream ss;
+        ss << "Game" << gameInd;
+        auto filename = ss.str();
+        thread_local std::ofstream file(filename);
+        Log() = Logger(std::move(filename), file);
+
+        GameRecorder recorder(dataset_.get(), false, config_.canonical);
+        auto result = PlayGenomes(first.genome, second.genome, config_.mutation, recorder,
+                                  {evalCache_, config_.canonical, config_.adjudication}, first.netId, second.netId);
+        Score(first, second, result.win);
+        adjudicationStats_.Add(result.adjudication, result.plies);
+        Log() << "won " << result.win;
+    }
+
+    // The same games as the local pool, in batches of whole rounds, or of one round for Swiss
+    // pairings which depend on the results so far.
+    void TeachRemotely() {
+        std::vector<distributed::GameAssignment> assignments;
+        std::vector<std::pair<size_t, size_t>> matches;
+        auto flush = [&]() {
+            coordinator_->Play(assignments, [&](size_t index, distributed::GameResult result) {
+                auto [firstInd, secondInd] = matches[index];
+                Score(whiteBots_[firstInd], blackBots_[secondInd], result.win);
+                adjudicationStats_.Add(result.adjudication, result.plies);
+                if (dataset_) {
+                    dataset_->Append(result.records);
+                }
+            });
+            assignments.clear();
+            matches.clear();
+        };
+
+        std::uint32_t gameInd = 0;
+        auto numRounds = NumRounds();
+        for (size_t round = 0; round < numRounds; ++round) {
+            auto opponents = PairOpponents(round);
+            for (size_t firstInd = 0; firstInd < numBots_; ++firstInd) {
+                assignments.push_back({whiteBots_[firstInd].genome, blackBots_[opponents[firstInd]].genome,
+                                       config_.mutation, gameInd++, dataset_ != nullptr, config_.canonical,
+                                       config_.adjudication});
+                matches.emplace_back(firstInd, opponents[firstInd]);
+            }
+            if (config_.pairing == Pairing::Swiss) {
+                flush();
+            }
+        }
+        flush();
+        Log() << "Played " << gameInd << " games in " << numRounds << " rounds on "
+              << coordinator_->NumWorkers() << " workers";
+    }
+
+    void Score(Student& first, Student& second, int win) {
+        std::unique_lock firstLock(*first.mutex, std::defer_lock);
+        std::unique_lock secondLock(*second.mutex, std::defer_lock);
+        std::lock(firstLock, secondLock);
+
+        if (win == 4) {
+            throw std::runtime_error("WFT");
+        }
+        if (win == 0) {
+            first.score += 2;
+        } else if (win == 1) {
+            second.score += 2;
+        } else {
+            assert(win == 2);
+            ++first.score;
+            ++second.score;
+        }
+    }
+
     void ZeroScore(std::vector<Student>& models) {
         for (auto& model : models) {
             model.score = 0;
+            model.played.clear();
         }
     }
 
     void Update(std::vector<Student>& models) {
-        std::sort(models.begin(), models.end());
+        // Best first.
+        std::sort(models.rbegin(), models.rend());
 
+        // Only the parents are materialized, their children share the weights. The parents keep
+        // their weights and so their cached evaluations.
         const size_t numBest = 2;
-        std::vector<Sequential> bestModels(numBest);
+        std::vector<std::shared_ptr<const ValueNet>> bestModels(numBest);
         for (size_t i = 0; i < numBest; ++i) {
-            bestModels[i] = *models[i].bot;
+            bestModels[i] = models[i].genome.Materialize(config_.mutation);
+            models[i].genome = Genome{bestModels[i], 0};
         }
 
         // Noise population
         for (size_t i = bestModels.size(); i < models.size(); ++i) {
             // Choose one of two best models
-            size_t index = GenerateNormalNumber() < 0.0;
-            models[i].bot = std::make_shared<Sequential>(bestModels[index]);
-            models[i].bot->ApplyNoise();
+            size_t index = rng_.Below(numBest);
+            models[i].genome = Genome{bestModels[index], NextSeed()};
+            models[i].netId = EvalCache::NewNetworkId();
         }
     }
 
-    int Play(GameManager& game, Controller controller) {
-        try {
-            while (true) {
-                controller.NextMove();
+    // Zero seeds mean no mutation.
+    std::uint64_t NextSeed() {
+        return (static_cast<std::uint64_t>(rng_()) << 32 | rng_()) | 1;
+    }
+
+    const SchoolConfig config_;
+    const size_t numBots_;
+    Philox rng_;
+    std::vector<Student> whiteBots_;
+    std::vector<Student> blackBots_;
+    Student bestBlack_;
+    std::shared_ptr<DatasetWriter> dataset_;
+    std::shared_ptr<distributed::Coordinator> coordinator_;
+    std::shared_ptr<EvalCache> evalCache_;
+    AdjudicationStats adjudicationStats_;
+};
+
+double CpuHours() {
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC / 3600;
+}
+
+using BotFactory = std::function<std::shared_ptr<AiBot>()>;
+
+// Score of the first bot in [0, 1] over numGames headless games with alternating colors.
+// Both bots explore a little, otherwise two deterministic bots would replay the same two games.
+double Arena(const BotFactory& first, const BotFactory& second, size_t numGames, size_t numThreads) {
+    static constexpr double EXPLORATION = 0.05;
+    std::vector<int> points(numGames);
+    {
+        ThreadPool pool(numThreads);
+        for (size_t i = 0; i < numGames; ++i) {
+            pool.AddTask([&, i]() {
+                Log() = Logger("arena", NullStream());
+                auto firstBot = first();
+                auto secondBot = second();
+                firstBot->SetExploration(EXPLORATION, 2 * i);
+                secondBot->SetExploration(EXPLORATION, 2 * i + 1);
+                bool firstIsWhite = i % 2 == 0;
+
+                EmptyRenderer renderer;
+                GameManager game(8, 8, renderer);
+                game.InitBoard();
+                game.Start();
+                Controller controller(
+                    game,
+                    firstIsWhite ? firstBot : secondBot,
+                    firstIsWhite ? secondBot : firstBot);
+                auto win = PlayGame(game, controller, [](const auto&, bool) {});
+                if (win == 2) {
+                    points[i] = 1;
+                } else if ((win == 0) == firstIsWhite) {
+                    points[i] = 2;
+                }
+            });
+        }
+        pool.WaitAll();
+    }
+    return std::accumulate(points.begin(), points.end(), 0.0) / (2.0 * numGames);
+}
+
+using PlayerFactory = std::function<std::unique_ptr<Player>()>;
+
+struct MatchResult {
+    // Of the first player, in [0, 1].
+    double score = 0;
+    size_t wins = 0;
+    size_t draws = 0;
+    size_t losses = 0;
+    // Games lost on time, by either player.
+    size_t forfeits = 0;
+    double firstMsPerMove = 0;
+    double secondMsPerMove = 0;
+};
+
+// numGames headless games between fresh players under the time control, with alternating colors.
+// Both games of a pair start from the same OPENING_PLIES random moves, so that players that do
+// not explore still play different games. With a node budget and no time limit, single-threaded
+// players give the same result on any machine and under any load.
+MatchResult Match(const PlayerFactory& first, const PlayerFactory& second, const TimeControl& timeControl,
+                  size_t numGames, size_t numThreads, std::uint64_t seed) {
+    static constexpr int OPENING_PLIES = 4;
+    struct Outcome {
+        int points = 0;
+        bool forfeit = false;
+        TimeControl::Clock::duration firstUsed{0};
+        TimeControl::Clock::duration secondUsed{0};
+        int firstMoves = 0;
+        int secondMoves = 0;
+    };
+    std::vector<Outcome> games(numGames);
+    {
+        ThreadPool pool(numThreads);
+        std::vector<std::shared_ptr<Task>> tasks;
+        for (size_t i = 0; i < numGames; ++i) {
+            tasks.push_back(pool.AddTask([&, i]() {
+                Log() = Logger("match", NullStream());
+                bool firstIsWhite = i % 2 == 0;
+                std::shared_ptr<Player> firstPlayer = first();
+                std::shared_ptr<Player> secondPlayer = second();
+
+                EmptyRenderer renderer;
+                GameManager game(8, 8, renderer);
+                game.InitBoard();
+                game.Start();
+                Philox rng(seed, i / 2);
+                for (int ply = 0; ply < OPENING_PLIES; ++ply) {
+                    auto moves = game.GetPosition().Moves();
+                    game.ApplyMove(moves[rng.Below(moves.Size())]);
+                }
+                Controller controller(
+                    game,
+                    firstIsWhite ? firstPlayer : secondPlayer,
+                    firstIsWhite ? secondPlayer : firstPlayer,
+                    timeControl);
+                auto win = PlayGame(game, controller, [](const auto&, bool) {});
+                if (win == 2) {
+                    games[i].points = 1;
+                } else if ((win == 0) == firstIsWhite) {
+                    games[i].points = 2;
+                }
+                const auto& clock = controller.Clock();
+                games[i].forfeit = win != 2 && clock.Flagged(game.IsWhitesTurn());
+                games[i].firstUsed = clock.Used(firstIsWhite);
+                games[i].secondUsed = clock.Used(!firstIsWhite);
+                games[i].firstMoves = clock.Moves(firstIsWhite);
+                games[i].secondMoves = clock.Moves(!firstIsWhite);
+            }));
+        }
+        for (auto& task : tasks) {
+            task->Wait();
+            task->IsCompletedOrThrow();
+        }
+    }
+
+    MatchResult result;
+    TimeControl::Clock::duration firstUsed{0};
+    TimeControl::Clock::duration secondUsed{0};
+    int firstMoves = 0;
+    int secondMoves = 0;
+    for (const auto& game : games) {
+        result.score += game.points / (2.0 * numGames);
+        ++(game.points == 2 ? result.wins : game.points == 1 ? result.draws : result.losses);
+        result.forfeits += game.forfeit;
+        firstUsed += game.firstUsed;
+        secondUsed += game.secondUsed;
+        firstMoves += game.firstMoves;
+        secondMoves += game.secondMoves;
+    }
+    using Ms = std::chrono::duration<double, std::milli>;
+    result.firstMsPerMove = Ms(firstUsed).count() / std::max(firstMoves, 1);
+    result.secondMsPerMove = Ms(secondUsed).count() / std::max(secondMoves, 1);
+    return result;
+}
+
+struct TdConfig {
+    size_t numThreads = DefaultNumThreads();
+    size_t gamesPerEpoch = 64;
+    size_t stepsPerEpoch = 200;
+    size_t batchSize = 256;
+    float learningRate = 0.01;
+    float lambda = 0.7;
+    double exploration = 0.1;
+    std::uint64_t seed = 1;
+    // Learn the value of Position::Canonical for the side to move, see AiBot::SetCanonical.
+    bool canonical = false;
+};
+
+// Learns a ValueNet from self-play with TD(lambda) targets and minibatch gradient steps.
+class TdTrainer {
+    struct Sample {
+        BoardCodes codes;
+        float target;
+        // Turns values for the whites into values for the sample's whites, -1 for flipped ones.
+        float sign = 1;
+    };
+
+public:
+    explicit TdTrainer(TdConfig config)
+        : config_(config)
+        , net_(std::make_shared<ValueNet>(config.seed))
+        , pool_(config.numThreads)
+        , grads_(config.numThreads, ValueNet::Gradients(ValueNet::NUM_PARAMS))
+        , rng_(config.seed)
+    {}
+
+    // One generation: self-play games with the current net, then gradient steps on their positions.
+    void Epoch() {
+        ALLOC_SCOPE_PROCESS("TdTrainer::Epoch");
+        sf::Clock clock;
+        std::vector<std::vector<Sample>> games(config_.gamesPerEpoch);
+        for (size_t i = 0; i < games.size(); ++i) {
+            pool_.AddTask([this, &games, i, seed = rng_()]() {
+                games[i] = SelfPlay(seed);
+            });
+        }
+        pool_.WaitAll();
+        samples_.clear();
+        for (auto& game : games) {
+            samples_.insert(samples_.end(), game.begin(), game.end());
+        }
+        auto selfPlaySeconds = clock.restart().asSeconds();
+
+        std::vector<const Sample*> batch;
+        for (size_t step = 0; step < config_.stepsPerEpoch; ++step) {
+            batch.clear();
+            std::uniform_int_distribution<size_t> dist(0, samples_.size() - 1);
+            for (size_t i = 0; i < config_.batchSize; ++i) {
+                batch.push_back(&samples_[dist(rng_)]);
             }
-        } catch (const std::runtime_error& e) {
-            if (e.what() != std::string("Lost!")) {
-                throw;
+            GradientStep(batch, [](const Sample* sample) {
+                return std::make_pair(sample->codes, sample->target);
+            });
+        }
+        auto trainSeconds = clock.restart().asSeconds();
+
+        ++epoch_;
+        Log() << "td epoch " << epoch_ << ": " << samples_.size() / selfPlaySeconds
+              << " self-play positions/sec, "
+              << config_.stepsPerEpoch * config_.batchSize / trainSeconds << " training positions/sec";
+    }
+
+    // Value regression on recorded games: the target of every position is its game result.
+    void TrainOn(const DatasetReader& dataset, size_t steps) {
+        sf::Clock clock;
+        std::mt19937_64 rng(config_.seed);
+        std::vector<const TrainingRecord*> batch;
+        for (size_t step = 0; step < steps; ++step) {
+            dataset.Sample(config_.batchSize, rng, batch);
+            if (batch.empty()) {
+                return;
             }
-            if (game.IsWhitesTurn()) {
-                return 1;
+            GradientStep(batch, [](const TrainingRecord* record) {
+                return std::make_pair(record->Unpack(), static_cast<float>(record->result));
+            });
+        }
+        Log() << "regression on " << dataset.Size() << " positions: "
+              << steps * config_.batchSize / clock.getElapsedTime().asSeconds() << " training positions/sec";
+    }
+
+    std::shared_ptr<const ValueNet> GetNet() const {
+        return net_;
+    }
+
+private:
+    std::vector<Sample> SelfPlay(std::uint64_t seed) {
+        Log() = Logger("td", NullStream());
+        auto white = std::make_shared<AiBot>(GetNet());
+        auto black = std::make_shared<AiBot>(GetNet());
+        white->SetExploration(config_.exploration, seed);
+        black->SetExploration(config_.exploration, seed + 1);
+        white->SetCanonical(config_.canonical);
+        black->SetCanonical(config_.canonical);
+
+        EmptyRenderer renderer;
+        GameManager game(8, 8, renderer);
+        game.InitBoard();
+        game.Start();
+        Controller controller(game, white, black);
+        std::vector<Sample> samples;
+        auto win = PlayGame(game, controller, [&](const Position& position, bool whitesTurn) {
+            if (config_.canonical && !whitesTurn) {
+                samples.push_back({position.Flipped().Encode(), 0, -1});
+            } else {
+                samples.push_back({position.Encode(), 0});
             }
-            return 0;
-        } catch (...) {
-            return 3;
+        });
+
+        // Lambda-returns for the whites, backwards: G_t = (1 - lambda) * V(s_t+1) + lambda * G_t+1,
+        // G_T = result.
+        static constexpr float RESULTS[] = {1, -1, 0};
+        float target = RESULTS[win];
+        for (size_t i = samples.size(); i-- > 0;) {
+            samples[i].target = samples[i].sign * target;
+            target = (1 - config_.lambda) * samples[i].sign * net_->Forward(samples[i].codes) + config_.lambda * target;
+        }
+        return samples;
+    }
+
+    // Mean squared error step. Every worker accumulates the gradients of its slice of the batch
+    // into its own buffer, the buffers are summed at the end.
+    template <class Batch, class Unpack>
+    void GradientStep(const Batch& batch, Unpack unpack) {
+        auto numWorkers = grads_.size();
+        auto sliceSize = (batch.size() + numWorkers - 1) / numWorkers;
+        for (size_t worker = 0; worker < numWorkers; ++worker) {
+            pool_.AddTask([&, worker]() {
+                auto& grads = grads_[worker];
+                std::fill(grads.begin(), grads.end(), 0.0F);
+                ValueNet::Activations activations;
+                auto end = std::min(batch.size(), (worker + 1) * sliceSize);
+                for (size_t i = worker * sliceSize; i < end; ++i) {
+                    auto [codes, target] = unpack(batch[i]);
+                    auto value = net_->Forward(codes, activations);
+                    net_->Backward(codes, activations, value - target, grads);
+                }
+            });
         }
-        return 2;
+        pool_.WaitAll();
+        for (size_t worker = 1; worker < numWorkers; ++worker) {
+            for (size_t i = 0; i < ValueNet::NUM_PARAMS; ++i) {
+                grads_[0][i] += grads_[worker][i];
+            }
+        }
+        net_->Step(grads_[0], config_.learningRate / batch.size());
     }
 
-    const int numBots_;
-    std::vector<Student> whiteBots_;
-    std::vector<Student> blackBots_;
-    Student bestBlack_;
+    TdConfig config_;
+    std::shared_ptr<ValueNet> net_;
+    ThreadPool pool_;
+    std::vector<ValueNet::Gradients> grads_;
+    std::vector<Sample> samples_;
+    std::mt19937_64 rng_;
+    size_t epoch_ = 0;
+};
+
+struct GameLog {
+    std::string name;
+    // (whites, cellId) of every click in order.
+    std::vector<std::pair<bool, int>> clicks;
 };
 
+// Controller logs clicks as "<logger id>: (whites,<cellId>)". School workers append all their games
+// to one file, so games are told apart by the logger id.
+std::vector<GameLog> ReadGameLogs(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    std::vector<GameLog> logs;
+    std::string line;
+    while (std::getline(file, line)) {
+        auto colon = line.find(": (");
+        if (colon == std::string::npos) {
+            continue;
+        }
+        auto color = line.substr(colon + 3, 7);
+        if (color != "whites," && color != "blacks,") {
+            continue;
+        }
+        auto name = line.substr(0, colon);
+        if (logs.empty() || logs.back().name != name) {
+            logs.push_back({name, {}});
+        }
+        logs.back().clicks.emplace_back(color == "whites,", std::stoi(line.substr(colon + 10)));
+    }
+    return logs;
+}
+
 class Game {
 public:
     inline static const sf::ContextSettings SETTINGS = sf::ContextSettings(0, 0, 16);
 
+    static constexpr unsigned MAX_FPS = 60;
+
     Game() :
         window_(sf::VideoMode(640, 640), "SFML works!", sf::Style::Default, SETTINGS),
         events_(window_),
-        renderer_(window_),
+        renderer_(window_, SETTINGS),
         game_(8, 8, renderer_)
     {
-        game_.InitBoard("board_8x8.png");
+        window_.setFramerateLimit(MAX_FPS);
+        game_.InitBoard();
         game_.Start();
     }
 
-    void PlayWithHuman() {
+    void PlayWithHuman(TimeControl timeControl = {}) {
         auto controller = std::make_unique<Controller>(
             game_,
             std::make_unique<Human>(events_),
-            std::make_unique<Human>(events_));
+            std::make_unique<Human>(events_),
+            timeControl);
         Run(*controller);
     }
 
-    void PlayWith(std::unique_ptr<Player> secondPlayer) {
+    void PlayWith(std::unique_ptr<Player> secondPlayer, TimeControl timeControl = {}) {
         auto controller = std::make_unique<Controller>(
             game_,
             std::make_unique<Human>(events_),
-            std::move(secondPlayer));
+            std::make_unique<AsyncPlayer>(std::move(secondPlayer)),
+            timeControl);
         Run(*controller);
     }
 
+    // Replays the first game of the log.
     void Simulate(std::string path) {
-        std::ifstream file(path);
+        auto logs = ReadGameLogs(path);
+        if (logs.empty()) {
+            throw std::runtime_error("no games in " + path);
+        }
         std::vector<int> wt, bt;
-//        std::vector<std::vector<int>> wt, bt;
-        std::string line;
-        bool whitesTurn = true;
-        while (std::getline(file, line)) {
-            auto ind = line.find('(');
-            auto substr = line.substr(ind + 1, 6);
-            auto turn = std::stoi(line.substr(ind + 8));
-            if (substr == "whites") {
-                wt.push_back(turn);
-//                if (whitesTurn) {
-//                wt.back().push_back(turn);
-//                } else {
-//                    whitesTurn = true;
-//                    wt.emplace_back().push_back(turn);
-//                }
-            } else if (substr == "blacks") {
-                bt.push_back(turn);
-
-//                if (whitesTurn) {
-//                    whitesTurn = false;
-//                    bt.emplace_back().push_back(turn);
-//                } else {
-//                    bt.back().push_back(turn);
-//                }
-            }
+        for (auto [whites, cellId] : logs.front().clicks) {
+            (whites ? wt : bt).push_back(cellId);
         }
         auto controller = std::make_unique<Controller>(
             game_,
@@ -1161,10 +2706,37 @@ private:
     int Run(Controller& controller) {
         try {
             while (window_.isOpen()) {
-                renderer_.Render();
+                if (events_.TakeHudToggle()) {
+                    renderer_.ToggleHud();
+                    // A human blocked in Events::WaitEvent wakes up for the HUD's refreshes.
+                    events_.SetWakePeriod(renderer_.HudVisible() ? Hud::REFRESH_PERIOD : sf::Time::Zero);
+                }
+                const auto& stats = Stats();
+                Hud::Values values{frameTime_.asMicroseconds() / 1000.0F, 0, stats.thinkMs, stats.evaluations,
+                                   stats.eval, std::nullopt, std::nullopt};
+                const auto& clock = controller.Clock();
+                if (clock.Control().HasClock()) {
+                    values.whiteSeconds = std::chrono::duration<float>(clock.Remaining(true)).count();
+                    values.blackSeconds = std::chrono::duration<float>(clock.Remaining(false)).count();
+                }
+                renderer_.UpdateHud(values);
+
+                // Nothing is drawn while a human thinks: Human blocks in Events::WaitEvent, unless
+                // the HUD is up.
+                if (renderer_.IsDirty() || events_.TakeRedraw()) {
+                    // Without display, which sleeps for the frame rate limit.
+                    sf::Clock frameClock;
+                    renderer_.Render();
+                    frameTime_ = frameClock.getElapsedTime();
+                    window_.display();
+                    frameStats_.OnFrame(events_.TakeClickLatency());
+                }
 
-                if (events_.Poll()) {
-                    controller.NextMove();
+                if (events_.Poll() && !controller.NextMove() && !renderer_.IsDirty() && !controller.ClicksToMove() &&
+                    !events_.TookEvent()) {
+                    // A bot is thinking on another thread, check for its move once per frame after
+                    // draining the queued events.
+                    sf::sleep(sf::seconds(1.0F / MAX_FPS));
                 }
             }
         } catch (const OutOfMovesError& e) {
@@ -1184,12 +2756,542 @@ private:
     Events events_;
     BoardRenderer renderer_;
     GameManager game_;
+    FrameStats frameStats_;
+    // Render of the last frame, without the display.
+    sf::Time frameTime_;
 };
 
 void Simulate(std::string path) {
     Game().Simulate(std::move(path));
 }
 
+struct ArchiveConfig {
+    // Threads replaying and rasterizing games.
+    size_t numThreads = DefaultNumThreads();
+    // Threads compressing PNGs, so encoding never stalls the rasterizers.
+    size_t numEncoders = DefaultNumThreads();
+    // One thumbnail grid per game instead of a full-size frame per move.
+    bool contactSheets = false;
+    unsigned thumbnailSize = 160;
+    unsigned sheetColumns = 8;
+};
+
+// Replays game logs offscreen and saves the position after every move. Frames go to
+// outDir/<log>/<game>/frame_NNNN.png, contact sheets to outDir/<log>/<game>.png.
+class ArchiveRenderer {
+public:
+    ArchiveRenderer(ArchiveConfig config, std::filesystem::path outDir)
+        : config_(config), outDir_(std::move(outDir)),
+          rasterPool_(config.numThreads), encodePool_(config.numEncoders),
+          // Bounds the decoded images waiting for an encoder.
+          pending_(4 * config.numEncoders) {
+    }
+
+    void Render(const std::vector<std::string>& logPaths) {
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& path : logPaths) {
+            auto dir = outDir_ / std::filesystem::path(path).stem();
+            for (auto& log : ReadGameLogs(path)) {
+                rasterPool_.AddTask([this, dir, log = std::move(log)]() {
+                    RenderGame(log, dir);
+                });
+            }
+        }
+        rasterPool_.WaitAll();
+        encodePool_.WaitAll();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        Log() << "Rendered " << numGames_ << " games, " << numImages_ << " images in "
+              << elapsed.count() << " s";
+    }
+
+private:
+    static constexpr int BOARD_SIZE = 8;
+
+    void RenderGame(const GameLog& log, const std::filesystem::path& dir) {
+        Log() = Logger("render", NullStream());
+        auto boardPixels = static_cast<unsigned>(BOARD_SIZE * CELL_SIZE);
+        auto size = config_.contactSheets ? config_.thumbnailSize : boardPixels;
+        sf::RenderTexture target;
+        if (!target.create(size, size, Game::SETTINGS)) {
+            throw std::runtime_error("cannot create a render texture");
+        }
+        target.setView(sf::View(sf::FloatRect(0, 0, boardPixels, boardPixels)));
+
+        BoardRenderer renderer(target, Game::SETTINGS);
+        GameManager game(BOARD_SIZE, BOARD_SIZE, renderer);
+        game.InitBoard();
+        game.Start();
+
+        std::vector<sf::Image> thumbnails;
+        size_t numFrames = 0;
+        auto capture = [&]() {
+            target.clear();
+            renderer.Render();
+            target.display();
+            auto image = target.getTexture().copyToImage();
+            if (config_.contactSheets) {
+                thumbnails.push_back(std::move(image));
+                return;
+            }
+            std::stringstream name;
+            name << "frame_" << std::setw(4) << std::setfill('0') << numFrames++ << ".png";
+            Encode(std::move(image), dir / log.name / name.str());
+        };
+
+        capture();
+        try {
+            for (auto [whites, cellId] : log.clicks) {
+                game.ProcessClick(cellId);
+                if (game.IsWhitesTurn() == whites) {
+                    continue;
+                }
+                capture();
+            }
+        } catch (const OutOfMovesError&) {
+            capture();
+        } catch (const DrawError&) {
+            capture();
+        }
+
+        if (config_.contactSheets) {
+            Encode(ContactSheet(thumbnails), dir / (log.name + ".png"));
+        }
+        ++numGames_;
+    }
+
+    sf::Image ContactSheet(const std::vector<sf::Image>& frames) const {
+        auto size = config_.thumbnailSize;
+        auto columns = std::min<unsigned>(config_.sheetColumns, frames.size());
+        auto rows = (frames.size() + columns - 1) / columns;
+        sf::Image sheet;
+        sheet.create(columns * size, rows * size, sf::Color::White);
+        for (const auto&[i, frame] : Enumerate(frames)) {
+            sheet.copy(frame, (i % columns) * size, (i / columns) * size);
+        }
+        return sheet;
+    }
+
+    void Encode(sf::Image image, std::filesystem::path path) {
+        pending_.acquire();
+        encodePool_.AddTask([this, image = std::move(image), path = std::move(path)]() {
+            std::filesystem::create_directories(path.parent_path());
+            if (!image.saveToFile(path.string())) {
+                Log() << "Cannot save " << path.string();
+            }
+            ++numImages_;
+            pending_.release();
+        });
+    }
+
+    ArchiveConfig config_;
+    std::filesystem::path outDir_;
+    ThreadPool rasterPool_;
+    ThreadPool encodePool_;
+    std::counting_semaphore<> pending_;
+    std::atomic<size_t> numGames_ = 0;
+    std::atomic<size_t> numImages_ = 0;
+};
+
+// Plays an MctsBot over a line protocol on stdin and stdout, so match runners can drive engines
+// in processes of their own:
+//   isready                                        -> readyok
+//   position startpos|<squares> <w|b> [moves <move>...]
+//   go [nodes <playouts>] [movetime <ms>] [wtime <ms> btime <ms> [winc <ms> binc <ms>]]
+//                                                  -> info ... and bestmove <move>|none
+//   stop
+//   quit
+// Positions and moves are written as in Position::ToString and Move::ToString. A search runs on a
+// thread of its own, so stop and isready are answered while it runs, position and go wait for it.
+// A bad command gets an "error ..." line and is otherwise ignored.
+class Engine {
+public:
+    Engine(std::unique_ptr<MctsBot> bot, size_t defaultPlayouts, std::istream& in, std::ostream& out)
+        : bot_(std::move(bot)), defaultPlayouts_(defaultPlayouts), in_(in), out_(out) {
+    }
+
+    ~Engine() {
+        StopSearch();
+    }
+
+    void Run() {
+        std::string line;
+        while (std::getline(in_, line)) {
+            std::string_view rest = line;
+            auto command = NextToken(rest);
+            try {
+                if (command.empty()) {
+                    continue;
+                } else if (command == "isready") {
+                    Reply("readyok");
+                } else if (command == "position") {
+                    WaitSearch();
+                    SetPosition(rest);
+                } else if (command == "go") {
+                    WaitSearch();
+                    Go(rest);
+                } else if (command == "stop") {
+                    StopSearch();
+                } else if (command == "quit") {
+                    StopSearch();
+                    return;
+                } else {
+                    throw std::runtime_error("unknown command " + std::string(command));
+                }
+            } catch (const std::exception& e) {
+                Reply(std::string("error ") + e.what());
+            }
+        }
+        // End of input lets the last search finish, for runners that pipe in a script.
+        WaitSearch();
+    }
+
+private:
+    static std::string_view NextToken(std::string_view& rest) {
+        auto begin = rest.find_first_not_of(" \t\r");
+        if (begin == std::string_view::npos) {
+            rest = {};
+            return {};
+        }
+        auto end = rest.find_first_of(" \t\r", begin);
+        auto token = rest.substr(begin, end - begin);
+        rest = end == std::string_view::npos ? std::string_view() : rest.substr(end);
+        return token;
+    }
+
+    static size_t ParseNumber(std::string_view token) {
+        size_t value = 0;
+        auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), value);
+        if (error != std::errc() || end != token.data() + token.size()) {
+            throw std::runtime_error("expected a number, got " + std::string(token));
+        }
+        return value;
+    }
+
+    void SetPosition(std::string_view rest) {
+        auto token = NextToken(rest);
+        Position position = Position::Initial();
+        int ply = 0;
+        if (token != "startpos") {
+            position = Position::FromString(token, NextToken(rest));
+        }
+        token = NextToken(rest);
+        if (token == "moves") {
+            for (token = NextToken(rest); !token.empty(); token = NextToken(rest)) {
+                auto move = position.FindMove(token);
+                if (!move) {
+                    throw std::runtime_error("illegal move " + std::string(token));
+                }
+                position = position.After(*move);
+                ++ply;
+            }
+        } else if (!token.empty()) {
+            throw std::runtime_error("expected moves, got " + std::string(token));
+        }
+        position_ = position;
+        ply_ = ply;
+    }
+
+    // The clocks go through AllocateTime, so the runner can play whole games at a time control.
+    void Go(std::string_view rest) {
+        auto start = MctsTree::Clock::now();
+        TimeControl control;
+        TimeControl::Duration clocks[2] = {};
+        TimeControl::Duration increments[2] = {};
+        for (auto token = NextToken(rest); !token.empty(); token = NextToken(rest)) {
+            if (token == "nodes") {
+                control.nodes = ParseNumber(NextToken(rest));
+            } else if (token == "movetime") {
+                control.moveTime = TimeControl::Duration(ParseNumber(NextToken(rest)));
+            } else if (token == "wtime" || token == "btime") {
+                clocks[token == "btime"] = TimeControl::Duration(ParseNumber(NextToken(rest)));
+            } else if (token == "winc" || token == "binc") {
+                increments[token == "binc"] = TimeControl::Duration(ParseNumber(NextToken(rest)));
+            } else {
+                throw std::runtime_error("unknown go option " + std::string(token));
+            }
+        }
+        auto side = position_.whitesTurn ? 0 : 1;
+        // Only turns the clock on, AllocateTime looks at the remaining time.
+        control.base = clocks[side];
+        control.increment = increments[side];
+        auto limits = AllocateTime(control, clocks[side], ply_, start);
+        if (limits.nodes == 0 && !limits.Timed()) {
+            limits.nodes = defaultPlayouts_;
+        }
+
+        stop_ = false;
+        searcher_ = std::thread([this, position = position_, limits, start]() {
+            auto result = bot_->Think(position, limits, stop_);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(MctsTree::Clock::now() - start);
+            std::stringstream info;
+            info << "info playouts " << result.playouts << " value " << result.value << " time " << ms.count();
+            Reply(info.str());
+            Reply(result.move ? "bestmove " + result.move->ToString() : std::string("bestmove none"));
+        });
+    }
+
+    void StopSearch() {
+        stop_ = true;
+        WaitSearch();
+    }
+
+    void WaitSearch() {
+        if (searcher_.joinable()) {
+            searcher_.join();
+        }
+    }
+
+    void Reply(const std::string& line) {
+        std::unique_lock lock(outMutex_);
+        out_ << line << std::endl;
+    }
+
+    std::unique_ptr<MctsBot> bot_;
+    size_t defaultPlayouts_;
+    std::istream& in_;
+    std::ostream& out_;
+    std::mutex outMutex_;
+    Position position_ = Position::Initial();
+    // Moves from the position command's start position, for the time management.
+    int ply_ = 0;
+    std::atomic<bool> stop_ = false;
+    std::thread searcher_;
+};
+
+// A test position whose side to move has a known best move, e.g. a shot that wins material.
+struct SuiteEntry {
+    std::string id;
+    Position position;
+    // Any of them solves the position.
+    std::vector<Move> best;
+};
+
+// One position per line: the 32 squares and the side to move as Position::ToString writes them,
+// the best moves as Move::ToString writes them, separated by commas, and an optional id after a
+// semicolon:
+//   ........b.......W............... w 12x21x30,12x26 ; queen double
+// Blank lines and lines starting with '#' are skipped.
+std::vector<SuiteEntry> ReadSuite(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    std::vector<SuiteEntry> entries;
+    std::string line;
+    for (size_t lineNumber = 1; std::getline(file, line); ++lineNumber) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        auto semicolon = line.find(';');
+        std::stringstream fields(line.substr(0, semicolon));
+        std::string squares, side, moves;
+        if (!(fields >> squares >> side >> moves)) {
+            throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": expected squares, side and moves");
+        }
+        SuiteEntry entry;
+        entry.position = Position::FromString(squares, side);
+        std::stringstream alternatives(moves);
+        std::string text;
+        while (std::getline(alternatives, text, ',')) {
+            auto move = entry.position.FindMove(text);
+            if (!move) {
+                throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": illegal move " + text);
+            }
+            entry.best.push_back(*move);
+        }
+        if (semicolon != std::string::npos) {
+            auto id = line.substr(semicolon + 1);
+            auto begin = id.find_first_not_of(" \t");
+            auto end = id.find_last_not_of(" \t\r");
+            if (begin != std::string::npos) {
+                entry.id = id.substr(begin, end - begin + 1);
+            }
+        }
+        if (entry.id.empty()) {
+            entry.id = "#" + std::to_string(entries.size() + 1);
+        }
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+struct SuiteLimits {
+    // Playouts of a searching player, 0 for no limit.
+    size_t nodes = 0;
+    // Thinking time of a searching player, zero for no limit.
+    std::chrono::milliseconds time{0};
+};
+
+struct SuiteResult {
+    bool solved = false;
+    std::optional<Move> played;
+    // Since when the player has stuck to a best move, valid if solved.
+    double seconds = 0;
+    std::uint64_t nodes = 0;
+};
+
+// An MctsBot searches in slices of 1/64 of the node budget and is done once it no longer changes
+// its mind, so the solution counts from the first slice after which the best move stayed right.
+// Other players get one Turn under the limits, the nodes are the positions an AiBot scored.
+SuiteResult Solve(Player& player, const SuiteEntry& entry, const SuiteLimits& limits) {
+    static constexpr size_t NUM_SLICES = 64;
+    static constexpr size_t MIN_SLICE = 16;
+    auto isBest = [&](const std::optional<Move>& move) {
+        return move && std::find(entry.best.begin(), entry.best.end(), *move) != entry.best.end();
+    };
+    auto start = MctsTree::Clock::now();
+    auto elapsed = [&]() {
+        return std::chrono::duration<double>(MctsTree::Clock::now() - start).count();
+    };
+
+    SuiteResult result;
+    auto* mcts = dynamic_cast<MctsBot*>(&player);
+    if (!mcts) {
+        auto* aiBot = dynamic_cast<AiBot*>(&player);
+        MoveLimits moveLimits;
+        moveLimits.nodes = limits.nodes;
+        if (limits.time.count() > 0) {
+            moveLimits.target = moveLimits.deadline = start + limits.time;
+        }
+        player.Limit(moveLimits);
+        result.played = player.Turn(entry.position);
+        result.solved = isBest(result.played);
+        result.seconds = elapsed();
+        result.nodes = aiBot ? aiBot->NumEvaluations() : 0;
+        return result;
+    }
+
+    if (limits.nodes == 0 && limits.time.count() == 0) {
+        throw std::runtime_error("a searching player needs a node or a time limit");
+    }
+    auto deadline = limits.time.count() > 0 ? start + limits.time : MctsTree::Clock::time_point::max();
+    auto slice = limits.nodes > 0 ? std::max(MIN_SLICE, limits.nodes / NUM_SLICES) : MIN_SLICE;
+    std::atomic<bool> stop = false;
+    std::uint64_t nodes = 0;
+    while ((limits.nodes == 0 || nodes < limits.nodes) && MctsTree::Clock::now() < deadline) {
+        auto budget = limits.nodes > 0 ? std::min<size_t>(slice, limits.nodes - nodes) : slice;
+        auto think = mcts->Think(entry.position, budget, deadline, stop);
+        nodes += think.playouts;
+        result.played = think.move;
+        if (!isBest(think.move)) {
+            result.solved = false;
+        } else if (!result.solved) {
+            result.solved = true;
+            result.seconds = elapsed();
+            result.nodes = nodes;
+        }
+        if (think.playouts == 0) {
+            // Nothing left to search, e.g. a single forced line to the end.
+            break;
+        }
+    }
+    return result;
+}
+
+// Runs a fresh player on every position, numThreads positions at a time, and logs a line per
+// position and the totals: solved count and the mean time and nodes to solution of the solved.
+void RunSuite(const std::vector<SuiteEntry>& entries, const PlayerFactory& factory, const SuiteLimits& limits,
+              size_t numThreads) {
+    std::vector<SuiteResult> results(entries.size());
+    {
+        ThreadPool pool(numThreads);
+        std::vector<std::shared_ptr<Task>> tasks;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            tasks.push_back(pool.AddTask([&, i]() {
+                Log() = Logger("suite", NullStream());
+                auto player = factory();
+                results[i] = Solve(*player, entries[i], limits);
+            }));
+        }
+        for (auto& task : tasks) {
+            task->Wait();
+            task->IsCompletedOrThrow();
+        }
+    }
+
+    size_t numSolved = 0;
+    double seconds = 0;
+    std::uint64_t nodes = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const auto& result = results[i];
+        if (result.solved) {
+            ++numSolved;
+            seconds += result.seconds;
+            nodes += result.nodes;
+            Log() << entries[i].id << ": solved in " << result.seconds * 1000 << " ms, " << result.nodes << " nodes";
+        } else {
+            Log() << entries[i].id << ": failed, played "
+                  << (result.played ? result.played->ToString() : std::string("nothing")) << " instead of "
+                  << entries[i].best.front().ToString();
+        }
+    }
+    auto divisor = std::max<size_t>(numSolved, 1);
+    Log() << "Solved " << numSolved << " of " << entries.size() << ", mean time to solution "
+          << seconds / divisor * 1000 << " ms, mean nodes to solution " << nodes / divisor;
+}
+
+// Saves the Chrome trace and logs the summary table of a CHECKERS_PROFILE build, logs allocation
+// counts of a CHECKERS_ALLOC_TRACKING build.
+void ExportProfile(const std::unordered_map<std::string, std::string>& options) {
+    if constexpr (alloc_tracker::ENABLED) {
+        std::stringstream summary;
+        alloc_tracker::WriteSummary(summary);
+        Log() << "Allocations\n" << summary.str();
+    }
+    if constexpr (!profiler::ENABLED) {
+        return;
+    }
+    auto path = options.contains("trace") ? options.at("trace") : std::string("trace.json");
+    std::ofstream trace(path);
+    profiler::WriteChromeTrace(trace);
+    std::stringstream summary;
+    profiler::WriteSummary(summary);
+    Log() << "Profile, trace saved to " << path << '\n' << summary.str();
+}
+
+// Parses "key=value" arguments starting from argv[first].
+std::unordered_map<std::string, std::string> ParseOptions(int argc, char** argv, int first) {
+    std::unordered_map<std::string, std::string> options;
+    for (int i = first; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        if (eq == std::string::npos) {
+            throw std::runtime_error("expected key=value, got " + arg);
+        }
+        options[arg.substr(0, eq)] = arg.substr(eq + 1);
+    }
+    return options;
+}
+
+Pairing ParsePairing(const std::string& name) {
+    if (name == "roundrobin") {
+        return Pairing::RoundRobin;
+    } else if (name == "swiss") {
+        return Pairing::Swiss;
+    } else if (name == "sampled") {
+        return Pairing::Sampled;
+    }
+    throw std::runtime_error("unknown pairing " + name);
+}
+
+// tc=<base>[+<increment>] in seconds and movetime=<ms>.
+TimeControl ParseTimeControl(const std::unordered_map<std::string, std::string>& options) {
+    TimeControl control;
+    if (options.contains("tc")) {
+        control = TimeControl::Parse(options.at("tc"));
+    }
+    if (options.contains("movetime")) {
+        control.moveTime = std::chrono::milliseconds(std::stoul(options.at("movetime")));
+    }
+    return control;
+}
+
+// Strength is reported as the score against a fixed randomly initialized ValueNet.
+static constexpr std::uint64_t REFERENCE_SEED = 12345;
+static constexpr size_t NUM_ARENA_GAMES = 32;
+
+// bench.cpp includes this file and brings its own main.
+#ifndef CHECKERS_BENCH
 int main(int argc, char** argv) {
     std::string bot;
     if (argc > 1) {
@@ -1198,22 +3300,334 @@ int main(int argc, char** argv) {
 
     int ret = -1;
     if (bot == "simple") {
-        Game().PlayWith(std::make_unique<SimpleBot>());
+        Game().PlayWith(std::make_unique<SimpleBot>(), ParseTimeControl(ParseOptions(argc, argv, 2)));
     } else if (bot == "ai") {
-        Game().PlayWith(std::make_unique<AiBot>(BuildNeuralNetwork()));
+        Game().PlayWith(std::make_unique<AiBot>(BuildNeuralNetwork()), ParseTimeControl(ParseOptions(argc, argv, 2)));
+    } else if (bot == "mcts") {
+        auto options = ParseOptions(argc, argv, 2);
+        MctsConfig config;
+        if (options.contains("playouts")) {
+            config.playouts = std::stoul(options.at("playouts"));
+        }
+        if (options.contains("threads")) {
+            config.numThreads = std::stoul(options.at("threads"));
+            if (config.numThreads == 0) {
+                throw std::runtime_error("threads must be at least 1");
+            }
+        }
+        if (options.contains("nodes")) {
+            config.poolSize = std::stoul(options.at("nodes"));
+        }
+        Game().PlayWith(std::make_unique<MctsBot>(BuildNeuralNetwork(), config), ParseTimeControl(options));
+    } else if (bot == "engine") {
+        auto options = ParseOptions(argc, argv, 2);
+        MctsConfig config;
+        if (options.contains("playouts")) {
+            config.playouts = std::stoul(options.at("playouts"));
+        }
+        if (options.contains("threads")) {
+            config.numThreads = std::stoul(options.at("threads"));
+            if (config.numThreads == 0) {
+                throw std::runtime_error("threads must be at least 1");
+            }
+        }
+        if (options.contains("nodes")) {
+            config.poolSize = std::stoul(options.at("nodes"));
+        }
+        // A net saved by ValueNet::Dump, the reference net otherwise.
+        auto net = std::make_shared<ValueNet>(REFERENCE_SEED);
+        if (options.contains("net")) {
+            std::ifstream file(options.at("net"));
+            if (!file) {
+                throw std::runtime_error("cannot open " + options.at("net"));
+            }
+            net->Load(file);
+        }
+        auto bot = std::make_unique<MctsBot>(std::shared_ptr<const ValueNet>(net), config);
+        // For nets trained with canonical=1.
+        bot->SetCanonical(options.contains("canonical") && options.at("canonical") == "1");
+        std::ios::sync_with_stdio(false);
+        Engine(std::move(bot), config.playouts, std::cin, std::cout).Run();
     } else if (bot == "learn") {
-        const int numBots = 4;
-        School school(numBots);
+        auto options = ParseOptions(argc, argv, 2);
+        SchoolConfig config;
+        if (options.contains("bots")) {
+            config.numBots = std::stoul(options.at("bots"));
+        }
+        if (options.contains("threads")) {
+            config.numThreads = std::stoul(options.at("threads"));
+        }
+        if (options.contains("budget")) {
+            config.gamesBudget = std::stoul(options.at("budget"));
+        }
+        if (options.contains("pairing")) {
+            config.pairing = ParsePairing(options.at("pairing"));
+        }
+        if (options.contains("mutation")) {
+            config.mutation.size = std::stoul(options.at("mutation"));
+        }
+        if (options.contains("sigma")) {
+            config.mutation.sigma = std::stof(options.at("sigma"));
+        }
+        if (options.contains("seed")) {
+            config.seed = std::stoull(options.at("seed"));
+        }
+        if (options.contains("evalcache")) {
+            config.evalCacheSize = std::stoul(options.at("evalcache"));
+        }
+        if (options.contains("canonical")) {
+            config.canonical = options.at("canonical") == "1";
+        }
+        if (options.contains("margin")) {
+            config.adjudication.materialMargin = std::stoi(options.at("margin"));
+        }
+        if (options.contains("marginplies")) {
+            config.adjudication.marginPlies = std::stoi(options.at("marginplies"));
+        }
+        if (options.contains("evalthreshold")) {
+            config.adjudication.evalThreshold = std::stof(options.at("evalthreshold"));
+        }
+        if (options.contains("evalplies")) {
+            config.adjudication.evalPlies = std::stoi(options.at("evalplies"));
+        }
+        if (options.contains("maxplies")) {
+            config.adjudication.maxPlies = std::stoi(options.at("maxplies"));
+        }
+        School school(config);
+        if (options.contains("dataset")) {
+            school.RecordTo(std::make_shared<DatasetWriter>(options.at("dataset")));
+        }
+        // unix:path or host:port to wait for `worker` processes on.
+        if (options.contains("listen")) {
+            school.DistributeTo(std::make_shared<distributed::Coordinator>(options.at("listen")));
+        }
         const int numEpochs = 20;
         for (int i = 0; i < numEpochs; ++i) {
             school.Teach();
             school.Update();
+            auto best = school.GetBest();
+            Log() << "evolution cpu-hours " << CpuHours() << ", score vs reference " << Arena(
+                [&]() {
+                    auto bot = std::make_shared<AiBot>(best);
+                    bot->SetCanonical(config.canonical);
+                    return bot;
+                },
+                []() { return std::make_shared<AiBot>(std::make_shared<ValueNet>(REFERENCE_SEED)); },
+                NUM_ARENA_GAMES, DefaultNumThreads());
+        }
+        ExportProfile(options);
+        auto black = std::make_unique<AiBot>(school.GetBest());
+        black->SetCanonical(config.canonical);
+        Game().PlayWith(std::move(black));
+    } else if (bot == "worker") {
+        // Plays the games of a `learn listen=` coordinator, one connection per thread.
+        auto options = ParseOptions(argc, argv, 2);
+        auto address = options.at("connect");
+        size_t numThreads = DefaultNumThreads();
+        if (options.contains("threads")) {
+            numThreads = std::stoul(options.at("threads"));
+        }
+        std::atomic<size_t> numGames = 0;
+        ThreadPool pool(numThreads);
+        std::vector<std::shared_ptr<Task>> connections;
+        for (size_t i = 0; i < numThreads; ++i) {
+            connections.push_back(pool.AddTask([&]() {
+                Log() = Logger("worker", NullStream());
+                distributed::Worker worker(address, [](const distributed::GameAssignment& assignment) {
+                    GameRecorder recorder(nullptr, assignment.record, assignment.canonical);
+                    auto result = PlayGenomes(assignment.white, assignment.black, assignment.mutation, recorder,
+                                              {nullptr, assignment.canonical, assignment.adjudication});
+                    return distributed::GameResult{result.win, result.adjudication, result.plies,
+                                                   recorder.TakeRecords()};
+                });
+                numGames += worker.Run();
+            }));
+        }
+        for (auto& connection : connections) {
+            connection->Wait();
+            connection->IsCompletedOrThrow();
+        }
+        Log() << "Played " << numGames << " games";
+    } else if (bot == "td") {
+        auto options = ParseOptions(argc, argv, 2);
+        TdConfig config;
+        if (options.contains("threads")) {
+            config.numThreads = std::stoul(options.at("threads"));
         }
-        auto black = school.GetBest();
-        Game().PlayWith(std::make_unique<AiBot>(std::move(black)));
+        if (options.contains("canonical")) {
+            config.canonical = options.at("canonical") == "1";
+        }
+        TdTrainer trainer(config);
+        if (options.contains("dataset")) {
+            trainer.TrainOn(DatasetReader(options.at("dataset")), 1000);
+        }
+        const int numEpochs = 20;
+        for (int i = 0; i < numEpochs; ++i) {
+            trainer.Epoch();
+            auto net = trainer.GetNet();
+            Log() << "td cpu-hours " << CpuHours() << ", score vs reference " << Arena(
+                [&]() {
+                    auto bot = std::make_shared<AiBot>(net);
+                    bot->SetCanonical(config.canonical);
+                    return bot;
+                },
+                []() { return std::make_shared<AiBot>(std::make_shared<ValueNet>(REFERENCE_SEED)); },
+                NUM_ARENA_GAMES, DefaultNumThreads());
+        }
+        ExportProfile(options);
+        auto bot = std::make_unique<AiBot>(trainer.GetNet());
+        bot->SetCanonical(config.canonical);
+        Game().PlayWith(std::move(bot));
+    } else if (bot == "suite") {
+        auto options = ParseOptions(argc, argv, 2);
+        auto entries = ReadSuite(options.at("file"));
+        SuiteLimits limits;
+        if (options.contains("nodes")) {
+            limits.nodes = std::stoul(options.at("nodes"));
+        }
+        if (options.contains("movetime")) {
+            limits.time = std::chrono::milliseconds(std::stoul(options.at("movetime")));
+        }
+        size_t numThreads = DefaultNumThreads();
+        if (options.contains("threads")) {
+            numThreads = std::stoul(options.at("threads"));
+        }
+        // Threads search different positions, a single MctsBot searches on one.
+        MctsConfig mctsConfig;
+        mctsConfig.numThreads = 1;
+        if (options.contains("pool")) {
+            mctsConfig.poolSize = std::stoul(options.at("pool"));
+        }
+        auto net = std::make_shared<ValueNet>(REFERENCE_SEED);
+        if (options.contains("net")) {
+            std::ifstream file(options.at("net"));
+            if (!file) {
+                throw std::runtime_error("cannot open " + options.at("net"));
+            }
+            net->Load(file);
+        }
+        bool canonical = options.contains("canonical") && options.at("canonical") == "1";
+        auto name = options.contains("player") ? options.at("player") : std::string("mcts");
+        PlayerFactory factory;
+        if (name == "mcts") {
+            if (!options.contains("nodes") && !options.contains("movetime")) {
+                limits.nodes = mctsConfig.playouts;
+            }
+            factory = [&]() {
+                auto player = std::make_unique<MctsBot>(std::shared_ptr<const ValueNet>(net), mctsConfig);
+                player->SetCanonical(canonical);
+                return player;
+            };
+        } else if (name == "ai") {
+            factory = [&]() {
+                auto player = std::make_unique<AiBot>(std::shared_ptr<const ValueNet>(net));
+                player->SetCanonical(canonical);
+                return player;
+            };
+        } else if (name == "simple") {
+            factory = []() { return std::make_unique<SimpleBot>(); };
+        } else {
+            throw std::runtime_error("unknown player " + name);
+        }
+        RunSuite(entries, factory, limits, numThreads);
+        ExportProfile(options);
+    } else if (bot == "match") {
+        // first= and second= are mcts, ai or simple, optionally with a net saved by ValueNet::Dump
+        // after a colon, e.g. first=mcts:best.net. The reference net plays otherwise.
+        auto options = ParseOptions(argc, argv, 2);
+        auto timeControl = ParseTimeControl(options);
+        if (options.contains("nodes")) {
+            timeControl.nodes = std::stoull(options.at("nodes"));
+        }
+        size_t numGames = NUM_ARENA_GAMES;
+        if (options.contains("games")) {
+            numGames = std::stoul(options.at("games"));
+        }
+        size_t numThreads = DefaultNumThreads();
+        if (options.contains("threads")) {
+            numThreads = std::stoul(options.at("threads"));
+        }
+        std::uint64_t seed = 0;
+        if (options.contains("seed")) {
+            seed = std::stoull(options.at("seed"));
+        }
+        // Threads play different games, a single MctsBot searches on one.
+        MctsConfig mctsConfig;
+        mctsConfig.numThreads = 1;
+        if (options.contains("pool")) {
+            mctsConfig.poolSize = std::stoul(options.at("pool"));
+        }
+        bool canonical = options.contains("canonical") && options.at("canonical") == "1";
+        auto makeFactory = [&](const std::string& spec) -> PlayerFactory {
+            auto colon = spec.find(':');
+            auto name = spec.substr(0, colon);
+            auto net = std::make_shared<ValueNet>(REFERENCE_SEED);
+            if (colon != std::string::npos) {
+                std::ifstream file(spec.substr(colon + 1));
+                if (!file) {
+                    throw std::runtime_error("cannot open " + spec.substr(colon + 1));
+                }
+                net->Load(file);
+            }
+            if (name == "mcts") {
+                return [=]() {
+                    auto player = std::make_unique<MctsBot>(std::shared_ptr<const ValueNet>(net), mctsConfig);
+                    player->SetCanonical(canonical);
+                    return player;
+                };
+            } else if (name == "ai") {
+                return [=]() {
+                    auto player = std::make_unique<AiBot>(std::shared_ptr<const ValueNet>(net));
+                    player->SetCanonical(canonical);
+                    return player;
+                };
+            } else if (name == "simple") {
+                return []() { return std::make_unique<SimpleBot>(); };
+            }
+            throw std::runtime_error("unknown player " + name);
+        };
+        auto first = options.contains("first") ? options.at("first") : std::string("mcts");
+        auto second = options.contains("second") ? options.at("second") : std::string("mcts");
+        auto result = Match(makeFactory(first), makeFactory(second), timeControl, numGames, numThreads, seed);
+        Log() << first << " vs " << second << ": score " << result.score << ", +" << result.wins << " ="
+              << result.draws << " -" << result.losses << ", " << result.forfeits << " lost on time, "
+              << result.firstMsPerMove << " vs " << result.secondMsPerMove << " ms per move";
+        ExportProfile(options);
     } else if (bot == "simulate") {
         Simulate(argv[2]);
+    } else if (bot == "render") {
+        auto options = ParseOptions(argc, argv, 2);
+        ArchiveConfig config;
+        if (options.contains("threads")) {
+            config.numThreads = std::stoul(options.at("threads"));
+        }
+        if (options.contains("encoders")) {
+            config.numEncoders = std::stoul(options.at("encoders"));
+        }
+        if (options.contains("sheets")) {
+            config.contactSheets = options.at("sheets") == "1";
+        }
+        if (options.contains("thumbnail")) {
+            config.thumbnailSize = std::stoul(options.at("thumbnail"));
+        }
+        // A single log or a directory of them.
+        std::filesystem::path logs = options.at("logs");
+        std::vector<std::string> paths;
+        if (std::filesystem::is_directory(logs)) {
+            for (const auto& entry : std::filesystem::directory_iterator(logs)) {
+                if (entry.is_regular_file()) {
+                    paths.push_back(entry.path().string());
+                }
+            }
+            std::sort(paths.begin(), paths.end());
+        } else {
+            paths.push_back(logs.string());
+        }
+        auto out = options.contains("out") ? options.at("out") : std::string("frames");
+        ArchiveRenderer(config, out).Render(paths);
+        ExportProfile(options);
     } else {
-        Game().PlayWithHuman();
+        Game().PlayWithHuman(ParseTimeControl(ParseOptions(argc, argv, 1)));
     }
 }
+#endif
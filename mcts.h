@@ -0,0 +1,351 @@
+#pragma once
+
+#include "position.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+struct MctsConfig {
+    // New playouts per move, the subtree kept from the previous move comes on top.
+    size_t playouts = 800;
+    size_t numThreads = 1;
+    // Nodes per tree, which bounds the memory: two trees of about 56 bytes a node. Once it is full
+    // the search goes on without growing the tree.
+    size_t poolSize = 1 << 18;
+    // Weight of the prior against the value in PUCT.
+    float cpuct = 1.5;
+    // Priors are a softmax over the children's values scaled by this.
+    float priorSharpness = 4;
+    // Every playout still on its way counts as a loss of this much for the nodes it went through,
+    // so that threads spread over the tree.
+    float virtualLoss = 1;
+};
+
+struct MctsNode {
+    enum : std::uint8_t {
+        UNEXPANDED,
+        EXPANDING,
+        EXPANDED,
+        // No moves or a draw, nothing to expand.
+        TERMINAL,
+    };
+
+    Move move;
+    std::uint16_t numChildren = 0;
+    std::atomic<std::uint8_t> state = UNEXPANDED;
+    float prior = 0;
+    // The evaluator's value of the node, used until it is visited.
+    float estimate = 0;
+    std::uint32_t firstChild = 0;
+    std::atomic<std::uint32_t> visits = 0;
+    // Playouts through the node that are not backed up yet.
+    std::atomic<std::uint32_t> pending = 0;
+    // Values are for the side that made the move, so a parent picks the child with the largest.
+    std::atomic<float> valueSum = 0;
+};
+
+// PUCT search over Positions. Nodes come from a preallocated pool with the children of a node
+// next to each other, so a tree never allocates. Playouts can run on several threads at once.
+//
+// Between moves SetRoot keeps the subtree of the new position by copying it to the second pool,
+// the rest of the old tree is dropped in one go.
+class MctsTree {
+public:
+    // The expected result for the whites, in [-1, 1]. Called from all searching threads.
+    using Evaluator = std::function<float(const Position&)>;
+    using Clock = std::chrono::steady_clock;
+
+    MctsTree(MctsConfig config, Evaluator evaluate)
+        : config_(config), evaluate_(std::move(evaluate)),
+          nodes_(std::make_unique<MctsNode[]>(config.poolSize)),
+          spare_(std::make_unique<MctsNode[]>(config.poolSize)) {
+        if (config_.poolSize < 2) {
+            throw std::runtime_error("MCTS pool is too small");
+        }
+    }
+
+    // Call while no playouts run. Keeps the subtree if the position is the root or up to two
+    // moves below it, i.e. after our move and the opponent's answer.
+    void SetRoot(const Position& position) {
+        if (used_ > 0 && rootPosition_ == position) {
+            return;
+        }
+        std::optional<std::uint32_t> kept;
+        if (used_ > 0) {
+            kept = Find(0, rootPosition_, position, 2);
+        }
+        if (kept) {
+            Compact(*kept);
+        } else {
+            std::destroy_at(&nodes_[0]);
+            std::construct_at(&nodes_[0]);
+            used_ = 1;
+        }
+        rootPosition_ = position;
+    }
+
+    // Runs playouts on the calling thread until `budget` is used up, `deadline` passes or `stop` is
+    // set.
+    void Search(std::atomic<std::int64_t>& budget, const std::atomic<bool>& stop,
+                Clock::time_point deadline = Clock::time_point::max()) {
+        std::vector<std::uint32_t> path;
+        bool timed = deadline != Clock::time_point::max();
+        while (!stop.load(std::memory_order_relaxed) && budget.fetch_sub(1, std::memory_order_relaxed) > 0) {
+            if (timed && Clock::now() >= deadline) {
+                return;
+            }
+            Playout(path);
+        }
+    }
+
+    // The most visited move of the root.
+    std::optional<Move> BestMove() const {
+        const auto& root = nodes_[0];
+        if (root.state != MctsNode::EXPANDED) {
+            return std::nullopt;
+        }
+        return MostVisited(root).move;
+    }
+
+    // The position `plies` moves down the most visited line, if the tree reaches that far.
+    std::optional<Position> ExpectedPosition(int plies) const {
+        if (used_ == 0) {
+            return std::nullopt;
+        }
+        auto position = rootPosition_;
+        const auto* node = &nodes_[0];
+        for (int ply = 0; ply < plies; ++ply) {
+            if (node->state != MctsNode::EXPANDED) {
+                return std::nullopt;
+            }
+            node = &MostVisited(*node);
+            position = position.After(node->move);
+        }
+        return position;
+    }
+
+    // For the side to move.
+    float RootValue() const {
+        const auto& root = nodes_[0];
+        if (root.visits == 0) {
+            return 0;
+        }
+        return -root.valueSum / root.visits;
+    }
+
+    std::uint32_t RootVisits() const {
+        return nodes_[0].visits;
+    }
+
+    size_t NumNodes() const {
+        return std::min<size_t>(used_, config_.poolSize);
+    }
+
+    std::uint64_t NumEvaluations() const {
+        return evaluations_;
+    }
+
+private:
+    // Of an expanded node.
+    const MctsNode& MostVisited(const MctsNode& node) const {
+        const MctsNode* best = nullptr;
+        for (std::uint32_t i = 0; i < node.numChildren; ++i) {
+            const auto& child = nodes_[node.firstChild + i];
+            if (!best || child.visits > best->visits ||
+                (child.visits == best->visits && child.estimate > best->estimate)) {
+                best = &child;
+            }
+        }
+        return *best;
+    }
+
+    // The value of `position` for its side to move.
+    float Evaluate(const Position& position) {
+        evaluations_.fetch_add(1, std::memory_order_relaxed);
+        auto value = evaluate_(position);
+        return position.whitesTurn ? value : -value;
+    }
+
+    // Takes `size` contiguous nodes, fails once the pool is full.
+    std::optional<std::uint32_t> Allocate(std::uint32_t size) {
+        auto first = used_.load(std::memory_order_relaxed);
+        do {
+            if (first + size > config_.poolSize) {
+                return std::nullopt;
+            }
+        } while (!used_.compare_exchange_weak(first, first + size, std::memory_order_relaxed));
+        return first;
+    }
+
+    void Playout(std::vector<std::uint32_t>& path) {
+        path.clear();
+        auto position = rootPosition_;
+        std::uint32_t index = 0;
+        path.push_back(index);
+        nodes_[index].pending.fetch_add(1, std::memory_order_relaxed);
+        while (nodes_[index].state.load(std::memory_order_acquire) == MctsNode::EXPANDED) {
+            index = Select(nodes_[index]);
+            position = position.After(nodes_[index].move);
+            path.push_back(index);
+            nodes_[index].pending.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // For the side to move at the leaf, the opposite of the side that made the leaf's move.
+        auto value = Expand(nodes_[index], position);
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            value = -value;
+            auto& node = nodes_[*it];
+            node.valueSum.fetch_add(value, std::memory_order_relaxed);
+            node.visits.fetch_add(1, std::memory_order_relaxed);
+            node.pending.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::uint32_t Select(const MctsNode& node) const {
+        auto parentVisits = node.visits.load(std::memory_order_relaxed) + node.pending.load(std::memory_order_relaxed);
+        auto exploration = config_.cpuct * std::sqrt(static_cast<float>(parentVisits) + 1);
+        auto bestScore = std::numeric_limits<float>::lowest();
+        std::uint32_t best = node.firstChild;
+        for (std::uint32_t i = 0; i < node.numChildren; ++i) {
+            const auto& child = nodes_[node.firstChild + i];
+            auto visits = child.visits.load(std::memory_order_relaxed);
+            auto pending = child.pending.load(std::memory_order_relaxed);
+            auto n = static_cast<float>(visits + pending);
+            float q = child.estimate;
+            if (n > 0) {
+                q = (child.valueSum.load(std::memory_order_relaxed) - pending * config_.virtualLoss) / n;
+            }
+            auto score = q + exploration * child.prior / (1 + n);
+            if (score > bestScore) {
+                bestScore = score;
+                best = node.firstChild + i;
+            }
+        }
+        return best;
+    }
+
+    // Returns the value of the leaf for its side to move. The thread that gets to expand it
+    // evaluates all children, one ply of lookahead that also gives the priors. Other threads, and
+    // all of them once the pool is full, evaluate the leaf alone.
+    float Expand(MctsNode& node, const Position& position) {
+        if (node.state.load(std::memory_order_acquire) == MctsNode::TERMINAL || position.IsDraw()) {
+            node.state.store(MctsNode::TERMINAL, std::memory_order_release);
+            return position.IsDraw() ? 0 : -1;
+        }
+        std::uint8_t expected = MctsNode::UNEXPANDED;
+        if (!node.state.compare_exchange_strong(expected, MctsNode::EXPANDING, std::memory_order_acquire)) {
+            return Evaluate(position);
+        }
+        auto moves = position.Moves();
+        if (moves.Empty()) {
+            node.state.store(MctsNode::TERMINAL, std::memory_order_release);
+            return -1;
+        }
+        auto first = Allocate(moves.Size());
+        if (!first) {
+            node.state.store(MctsNode::UNEXPANDED, std::memory_order_release);
+            return Evaluate(position);
+        }
+
+        // Children's values are for the side to move here.
+        auto max = std::numeric_limits<float>::lowest();
+        float sum = 0;
+        for (size_t i = 0; i < moves.Size(); ++i) {
+            auto& child = nodes_[*first + i];
+            std::destroy_at(&child);
+            std::construct_at(&child);
+            child.move = moves[i];
+            child.estimate = -Evaluate(position.After(moves[i]));
+            max = std::max(max, child.estimate);
+        }
+        for (size_t i = 0; i < moves.Size(); ++i) {
+            auto& child = nodes_[*first + i];
+            child.prior = std::exp(config_.priorSharpness * (child.estimate - max));
+            sum += child.prior;
+        }
+        for (size_t i = 0; i < moves.Size(); ++i) {
+            nodes_[*first + i].prior /= sum;
+        }
+        node.firstChild = *first;
+        node.numChildren = static_cast<std::uint16_t>(moves.Size());
+        node.state.store(MctsNode::EXPANDED, std::memory_order_release);
+        return max;
+    }
+
+    // The node of `target` at most `depth` moves below `index`.
+    std::optional<std::uint32_t> Find(std::uint32_t index, const Position& position, const Position& target,
+                                      int depth) const {
+        const auto& node = nodes_[index];
+        if (depth == 0 || node.state != MctsNode::EXPANDED) {
+            return std::nullopt;
+        }
+        for (std::uint32_t i = 0; i < node.numChildren; ++i) {
+            auto child = node.firstChild + i;
+            auto next = position.After(nodes_[child].move);
+            if (next == target) {
+                return child;
+            }
+            if (auto found = Find(child, next, target, depth - 1)) {
+                return found;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Copies the subtree of `root` to the spare pool breadth first, so children stay contiguous,
+    // and makes it the tree.
+    void Compact(std::uint32_t root) {
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> queue = {{root, 0}};
+        std::uint32_t used = 1;
+        Copy(nodes_[root], spare_[0]);
+        for (size_t i = 0; i < queue.size(); ++i) {
+            auto [from, to] = queue[i];
+            const auto& node = nodes_[from];
+            auto& copy = spare_[to];
+            if (node.state != MctsNode::EXPANDED) {
+                if (node.state != MctsNode::TERMINAL) {
+                    copy.state = MctsNode::UNEXPANDED;
+                }
+                continue;
+            }
+            copy.firstChild = used;
+            for (std::uint32_t j = 0; j < node.numChildren; ++j) {
+                Copy(nodes_[node.firstChild + j], spare_[used]);
+                queue.emplace_back(node.firstChild + j, used);
+                ++used;
+            }
+        }
+        std::swap(nodes_, spare_);
+        used_ = used;
+    }
+
+    static void Copy(const MctsNode& from, MctsNode& to) {
+        to.move = from.move;
+        to.numChildren = from.numChildren;
+        to.state.store(from.state.load());
+        to.prior = from.prior;
+        to.estimate = from.estimate;
+        to.firstChild = from.firstChild;
+        to.visits.store(from.visits.load());
+        to.pending.store(0);
+        to.valueSum.store(from.valueSum.load());
+    }
+
+    MctsConfig config_;
+    Evaluator evaluate_;
+    std::unique_ptr<MctsNode[]> nodes_;
+    std::unique_ptr<MctsNode[]> spare_;
+    std::atomic<std::uint32_t> used_ = 0;
+    Position rootPosition_;
+    std::atomic<std::uint64_t> evaluations_ = 0;
+};
@@ -0,0 +1,482 @@
+#pragma once
+
+#include "utils.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <compare>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// A move as the cells it visits: the start, then the captured and the landing cell of every
+// capture, or the start and the end of a quiet move. The order of a PathNode branch, so ToClicks
+// turns Path() into the clicks that play it.
+struct Move {
+    // A man of the 12 pieces captures at most all of the other side's ones.
+    static constexpr size_t MAX_CELLS = 1 + 2 * 12;
+
+    std::array<std::int8_t, MAX_CELLS> cells{};
+    std::uint8_t size = 0;
+
+    int From() const {
+        return cells[0];
+    }
+
+    int To() const {
+        return cells[size - 1];
+    }
+
+    bool IsCapture() const {
+        return size > 2;
+    }
+
+    std::vector<int> Path() const {
+        return {cells.begin(), cells.begin() + size};
+    }
+
+    void Push(int cellId) {
+        cells[size++] = static_cast<std::int8_t>(cellId);
+    }
+
+    // The clicked cells joined by '-' for a quiet move and by 'x' for a capture: "42-35", "56x42x24".
+    std::string ToString() const {
+        std::string text = std::to_string(From());
+        for (size_t i = IsCapture() ? 2 : 1; i < size; i += IsCapture() ? 2 : 1) {
+            text += IsCapture() ? 'x' : '-';
+            text += std::to_string(cells[i]);
+        }
+        return text;
+    }
+
+    bool operator==(const Move& other) const {
+        return size == other.size && std::equal(cells.begin(), cells.begin() + size, other.cells.begin());
+    }
+};
+
+// The legal moves of a position, on the stack.
+class MoveList {
+public:
+    static constexpr size_t CAPACITY = 256;
+
+    void Push(const Move& move) {
+        if (size_ == CAPACITY) {
+            throw std::runtime_error("Too many moves");
+        }
+        moves_[size_++] = move;
+    }
+
+    // Removes the moves from `first` on that match, keeping the order of the rest.
+    template <class Predicate>
+    void EraseIf(size_t first, Predicate predicate) {
+        size_t kept = first;
+        for (size_t i = first; i < size_; ++i) {
+            if (!predicate(moves_[i])) {
+                moves_[kept++] = moves_[i];
+            }
+        }
+        size_ = kept;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    const Move& operator[](size_t i) const {
+        return moves_[i];
+    }
+
+    const Move* begin() const {
+        return moves_.data();
+    }
+
+    const Move* end() const {
+        return moves_.data() + size_;
+    }
+
+private:
+    std::array<Move, CAPACITY> moves_;
+    size_t size_ = 0;
+};
+
+// The 8x8 game between two moves in 16 bytes, so bots can copy it to other threads and keep it in
+// caches without touching the live GameManager. Squares are the 32 dark cells in cell order,
+// square = cellId / 2, the rows of BoardCodes.
+//
+// Generates the moves GameManager allows: men step forward and capture in all directions, queens
+// fly, capturing is compulsory and goes on while it can, a queen that can go on capturing has to
+// land where it can. Captured pieces stay on the board until the end of the move and cannot be
+// jumped twice. A man reaching the last line mid-capture goes on as a queen, with the captured
+// pieces already gone.
+struct Position {
+    static constexpr int NUM_ROWS = 8;
+    static constexpr int NUM_COLS = 8;
+    static constexpr int NUM_SQUARES = NUM_ROWS * NUM_COLS / 2;
+    // Queen moves in a row without a capture or a man's move until the game is a draw.
+    static constexpr int TURNS_UNTIL_DRAW = 30;
+
+    std::uint32_t whites = 0;
+    std::uint32_t blacks = 0;
+    std::uint32_t queens = 0;
+    bool whitesTurn = true;
+    std::uint8_t turnsUntilDraw = TURNS_UNTIL_DRAW;
+
+    auto operator<=>(const Position&) const = default;
+
+    static Position Initial() {
+        Position position;
+        position.blacks = 0x00000FFF;
+        position.whites = 0xFFF00000;
+        return position;
+    }
+
+    static int ToSquare(int cellId) {
+        return cellId / 2;
+    }
+
+    static int ToCellId(int square) {
+        int row = square / 4;
+        return row * NUM_COLS + 2 * (square % 4) + (row % 2 == 0 ? 1 : 0);
+    }
+
+    void Put(int cellId, bool white, bool queen) {
+        auto bit = Bit(ToSquare(cellId));
+        (white ? whites : blacks) |= bit;
+        if (queen) {
+            queens |= bit;
+        }
+    }
+
+    bool IsDraw() const {
+        return turnsUntilDraw == 0;
+    }
+
+    // The colours swapped and the board turned by 180 degrees, square s becomes 31 - s and cell c
+    // becomes 63 - c. The rules are symmetric, so the moves and the result carry over.
+    Position Flipped() const {
+        Position flipped = *this;
+        flipped.whites = Reverse(blacks);
+        flipped.blacks = Reverse(whites);
+        flipped.queens = Reverse(queens);
+        flipped.whitesTurn = !whitesTurn;
+        return flipped;
+    }
+
+    // The position as seen by the side to move, which always plays the whites here. A position
+    // and its flip share one canonical form, and a value of the canonical position for the
+    // whites is the value of the original one for its side to move.
+    Position Canonical() const {
+        return whitesTurn ? *this : Flipped();
+    }
+
+    // The 32 squares as '.', 'w', 'W' for a white queen, 'b', 'B', then the side to move, e.g.
+    // "bbbbbbbbbbbb........wwwwwwwwwwww w".
+    std::string ToString() const {
+        std::string text(NUM_SQUARES, '.');
+        for (int square = 0; square < NUM_SQUARES; ++square) {
+            bool queen = queens & Bit(square);
+            if (whites & Bit(square)) {
+                text[square] = queen ? 'W' : 'w';
+            } else if (blacks & Bit(square)) {
+                text[square] = queen ? 'B' : 'b';
+            }
+        }
+        text += whitesTurn ? " w" : " b";
+        return text;
+    }
+
+    static Position FromString(std::string_view squares, std::string_view side) {
+        if (squares.size() != NUM_SQUARES || (side != "w" && side != "b")) {
+            throw std::runtime_error("Bad position: " + std::string(squares) + " " + std::string(side));
+        }
+        Position position;
+        for (int square = 0; square < NUM_SQUARES; ++square) {
+            auto c = squares[square];
+            if (c == '.') {
+                continue;
+            }
+            if (c != 'w' && c != 'W' && c != 'b' && c != 'B') {
+                throw std::runtime_error("Bad square: " + std::string(1, c));
+            }
+            position.Put(ToCellId(square), c == 'w' || c == 'W', c == 'W' || c == 'B');
+        }
+        position.whitesTurn = side == "w";
+        return position;
+    }
+
+    // The legal move written as Move::ToString writes it.
+    std::optional<Move> FindMove(std::string_view text) const {
+        std::array<int, Move::MAX_CELLS> clicks;
+        size_t numClicks = 0;
+        const char* begin = text.data();
+        const char* end = text.data() + text.size();
+        while (begin != end && numClicks < clicks.size()) {
+            auto [next, error] = std::from_chars(begin, end, clicks[numClicks]);
+            if (error != std::errc()) {
+                return std::nullopt;
+            }
+            ++numClicks;
+            begin = next;
+            if (begin != end && (*begin == '-' || *begin == 'x')) {
+                ++begin;
+            }
+        }
+        for (const auto& move : Moves()) {
+            size_t step = move.IsCapture() ? 2 : 1;
+            if ((move.size - 1) / step + 1 != numClicks) {
+                continue;
+            }
+            bool same = true;
+            for (size_t i = 0; i < numClicks; ++i) {
+                same = same && move.cells[i * step] == clicks[i];
+            }
+            if (same) {
+                return move;
+            }
+        }
+        return std::nullopt;
+    }
+
+    BoardCodes Encode() const {
+        BoardCodes codes;
+        for (int square = 0; square < NUM_SQUARES; ++square) {
+            auto bit = Bit(square);
+            bool queen = queens & bit;
+            if (whites & bit) {
+                codes[square] = queen ? CELL_WHITE_QUEEN : CELL_WHITE;
+            } else if (blacks & bit) {
+                codes[square] = queen ? CELL_BLACK_QUEEN : CELL_BLACK;
+            } else {
+                codes[square] = CELL_FREE;
+            }
+        }
+        return codes;
+    }
+
+    // In the order of GameManager's path trees: by cell, then by direction -9, -7, 7, 9.
+    // Empty if the side to move has lost.
+    MoveList Moves() const {
+        MoveList moves;
+        auto own = whitesTurn ? whites : blacks;
+        auto enemies = whitesTurn ? blacks : whites;
+        for (auto pieces = own; pieces; pieces &= pieces - 1) {
+            int square = std::countr_zero(pieces);
+            Capture capture{own, enemies, 0, (queens & Bit(square)) != 0, moves, {}};
+            capture.move.Push(ToCellId(square));
+            AddCaptures(capture, square, -1);
+        }
+        if (!moves.Empty()) {
+            return moves;
+        }
+        auto empty = ~(whites | blacks);
+        for (auto pieces = own; pieces; pieces &= pieces - 1) {
+            int square = std::countr_zero(pieces);
+            bool queen = queens & Bit(square);
+            int maxSteps = queen ? NUM_ROWS : 1;
+            for (int dir = 0; dir < NUM_DIRS; ++dir) {
+                if (!queen && IsForward(dir) != whitesTurn) {
+                    continue;
+                }
+                int to = square;
+                for (int step = 1; step <= maxSteps; ++step) {
+                    to = NEIGHBORS[to][dir];
+                    if (to == -1 || !(empty & Bit(to))) {
+                        break;
+                    }
+                    Move move;
+                    move.Push(ToCellId(square));
+                    move.Push(ToCellId(to));
+                    moves.Push(move);
+                }
+            }
+        }
+        return moves;
+    }
+
+    // The position after a legal move of the side to move.
+    Position After(const Move& move) const {
+        Position next = *this;
+        auto& own = whitesTurn ? next.whites : next.blacks;
+        auto& enemies = whitesTurn ? next.blacks : next.whites;
+        auto from = Bit(ToSquare(move.From()));
+        bool queen = queens & from;
+        own &= ~from;
+        next.queens &= ~from;
+
+        bool promoted = queen;
+        for (size_t i = 1; i < move.size; ++i) {
+            int square = ToSquare(move.cells[i]);
+            if (move.IsCapture() && i % 2 == 1) {
+                enemies &= ~Bit(square);
+                next.queens &= ~Bit(square);
+            } else if (IsLastRow(square, whitesTurn)) {
+                promoted = true;
+            }
+        }
+        auto to = Bit(ToSquare(move.To()));
+        own |= to;
+        if (promoted) {
+            next.queens |= to;
+        }
+
+        if (queen && !move.IsCapture()) {
+            --next.turnsUntilDraw;
+        } else {
+            next.turnsUntilDraw = TURNS_UNTIL_DRAW;
+        }
+        next.whitesTurn = !whitesTurn;
+        return next;
+    }
+
+private:
+    static constexpr int NUM_DIRS = 4;
+
+    // Of the side that moves, while a capture is being built.
+    struct Capture {
+        std::uint32_t own;
+        // Captured pieces stay in here, they block until the move ends.
+        std::uint32_t enemies;
+        std::uint32_t captured;
+        bool queen;
+        MoveList& moves;
+        Move move;
+    };
+
+    // Neighbor squares in the directions -9, -7, 7, 9 of cell ids, -1 off the board.
+    static constexpr auto NEIGHBORS = []() {
+        std::array<std::array<int, NUM_DIRS>, NUM_SQUARES> neighbors{};
+        constexpr int ROW_STEPS[NUM_DIRS] = {-1, -1, 1, 1};
+        constexpr int COL_STEPS[NUM_DIRS] = {-1, 1, -1, 1};
+        for (int square = 0; square < NUM_SQUARES; ++square) {
+            int row = square / 4;
+            int col = 2 * (square % 4) + (row % 2 == 0 ? 1 : 0);
+            for (int dir = 0; dir < NUM_DIRS; ++dir) {
+                int toRow = row + ROW_STEPS[dir];
+                int toCol = col + COL_STEPS[dir];
+                bool valid = toRow >= 0 && toRow < NUM_ROWS && toCol >= 0 && toCol < NUM_COLS;
+                neighbors[square][dir] = valid ? toRow * 4 + toCol / 2 : -1;
+            }
+        }
+        return neighbors;
+    }();
+
+    static constexpr std::uint32_t Bit(int square) {
+        return std::uint32_t(1) << square;
+    }
+
+    // Bit s goes to bit 31 - s.
+    static constexpr std::uint32_t Reverse(std::uint32_t bits) {
+        bits = (bits >> 1 & 0x55555555) | (bits & 0x55555555) << 1;
+        bits = (bits >> 2 & 0x33333333) | (bits & 0x33333333) << 2;
+        bits = (bits >> 4 & 0x0F0F0F0F) | (bits & 0x0F0F0F0F) << 4;
+        return (bits >> 24) | (bits >> 8 & 0xFF00) | (bits << 8 & 0xFF0000) | (bits << 24);
+    }
+
+    static constexpr int Opposite(int dir) {
+        return NUM_DIRS - 1 - dir;
+    }
+
+    // The whites move up the board.
+    static constexpr bool IsForward(int dir) {
+        return dir < 2;
+    }
+
+    static bool IsLastRow(int square, bool white) {
+        return white ? square < 4 : square >= NUM_SQUARES - 4;
+    }
+
+    // Adds the captures of the piece on `square`, never back in `forbiddenDir`. Returns whether
+    // there were any.
+    bool AddCaptures(Capture& capture, int square, int forbiddenDir) const {
+        bool any = false;
+        int maxSteps = capture.queen ? NUM_ROWS : 2;
+        for (int dir = 0; dir < NUM_DIRS; ++dir) {
+            if (dir == forbiddenDir) {
+                continue;
+            }
+            int enemy = -1;
+            std::array<int, NUM_ROWS> landings;
+            int numLandings = 0;
+            int cur = square;
+            for (int step = 1; step <= maxSteps; ++step) {
+                cur = NEIGHBORS[cur][dir];
+                if (cur == -1 || (capture.own & Bit(cur))) {
+                    break;
+                }
+                if (capture.enemies & Bit(cur)) {
+                    if (enemy != -1 || (capture.captured & Bit(cur))) {
+                        break;
+                    }
+                    enemy = cur;
+                } else if (enemy != -1) {
+                    landings[numLandings++] = cur;
+                }
+            }
+            if (numLandings == 0) {
+                continue;
+            }
+
+            any = true;
+            capture.captured |= Bit(enemy);
+            auto first = capture.moves.Size();
+            bool goesOn = false;
+            for (int i = 0; i < numLandings; ++i) {
+                capture.move.Push(ToCellId(enemy));
+                capture.move.Push(ToCellId(landings[i]));
+                bool more;
+                if (!capture.queen && IsLastRow(landings[i], whitesTurn)) {
+                    more = AddPromotedCaptures(capture, landings[i]);
+                } else {
+                    more = AddCaptures(capture, landings[i], Opposite(dir));
+                }
+                if (more) {
+                    goesOn = true;
+                } else {
+                    capture.moves.Push(capture.move);
+                }
+                capture.move.size -= 2;
+            }
+            // Landings the capture cannot go on from are only allowed if there are no others.
+            if (goesOn) {
+                auto size = capture.move.size + 2;
+                capture.moves.EraseIf(first, [&](const Move& move) {
+                    return move.size == size;
+                });
+            }
+            capture.captured &= ~Bit(enemy);
+        }
+        return any;
+    }
+
+    // The captures of a man that has just become a queen. GameManager takes the captured pieces and
+    // the piece itself off the board before it looks for them.
+    bool AddPromotedCaptures(Capture& capture, int square) const {
+        auto own = capture.own;
+        auto enemies = capture.enemies;
+        auto captured = capture.captured;
+        capture.own &= ~Bit(ToSquare(capture.move.From()));
+        capture.enemies &= ~captured;
+        capture.captured = 0;
+        capture.queen = true;
+        bool more = AddCaptures(capture, square, -1);
+        capture.own = own;
+        capture.enemies = enemies;
+        capture.captured = captured;
+        capture.queen = false;
+        return more;
+    }
+};
+
+static_assert(std::is_trivially_copyable_v<Position>);
+static_assert(sizeof(Position) <= 16);
+static_assert(std::is_trivially_copyable_v<Move>);
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Scoped timers and counters for hot paths. Built with CHECKERS_PROFILE (the cmake option of the
+// same name) PROFILE_SCOPE and PROFILE_COUNT record into per-thread buffers, without it they
+// compile to nothing. Names must be string literals: they are keyed by address.
+//
+// Export with WriteChromeTrace (open in chrome://tracing or Perfetto) or WriteSummary. Both read
+// every thread's buffer without locking, so call them while the instrumented threads are idle.
+namespace profiler {
+
+#ifdef CHECKERS_PROFILE
+inline constexpr bool ENABLED = true;
+#else
+inline constexpr bool ENABLED = false;
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+    const char* name;
+    std::int64_t startNs;
+    std::int64_t durationNs;
+};
+
+struct Stats {
+    std::int64_t count = 0;
+    std::int64_t totalNs = 0;
+    std::int64_t maxNs = 0;
+};
+
+struct ThreadBuffer {
+    // Past this many events a thread only keeps the summary stats.
+    static constexpr size_t MAX_EVENTS = 1 << 20;
+
+    size_t threadId = 0;
+    std::vector<Event> events;
+    std::unordered_map<const char*, Stats> stats;
+    std::unordered_map<const char*, std::int64_t> counters;
+};
+
+class Registry {
+public:
+    static Registry& Get() {
+        static Registry registry;
+        return registry;
+    }
+
+    // Buffers outlive their threads, so pool workers that are gone still show up in the export.
+    ThreadBuffer& Local() {
+        thread_local std::shared_ptr<ThreadBuffer> buffer = Register();
+        return *buffer;
+    }
+
+    std::int64_t Now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+    }
+
+    std::vector<std::shared_ptr<ThreadBuffer>> Buffers() const {
+        std::unique_lock lock(mutex_);
+        return buffers_;
+    }
+
+private:
+    std::shared_ptr<ThreadBuffer> Register() {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        std::unique_lock lock(mutex_);
+        buffer->threadId = buffers_.size();
+        buffers_.push_back(buffer);
+        return buffer;
+    }
+
+    Clock::time_point start_ = Clock::now();
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+};
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char* name) : name_(name), start_(Registry::Get().Now()) {
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() {
+        auto duration = Registry::Get().Now() - start_;
+        auto& buffer = Registry::Get().Local();
+        if (buffer.events.size() < ThreadBuffer::MAX_EVENTS) {
+            buffer.events.push_back({name_, start_, duration});
+        }
+        auto& stats = buffer.stats[name_];
+        ++stats.count;
+        stats.totalNs += duration;
+        stats.maxNs = std::max(stats.maxNs, duration);
+    }
+
+private:
+    const char* name_;
+    std::int64_t start_;
+};
+
+inline void Count(const char* name, std::int64_t value = 1) {
+    Registry::Get().Local().counters[name] += value;
+}
+
+inline void WriteChromeTrace(std::ostream& os) {
+    os << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto& buffer : Registry::Get().Buffers()) {
+        for (const auto& event : buffer->events) {
+            os << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+               << buffer->threadId << std::fixed << std::setprecision(3)
+               << ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0 << '}';
+            first = false;
+        }
+    }
+    os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+// Timers merged over threads, sorted by total time, then the counters.
+inline void WriteSummary(std::ostream& os) {
+    std::unordered_map<const char*, Stats> timers;
+    std::unordered_map<const char*, std::int64_t> counters;
+    for (const auto& buffer : Registry::Get().Buffers()) {
+        for (const auto& [name, stats] : buffer->stats) {
+            auto& total = timers[name];
+            total.count += stats.count;
+            total.totalNs += stats.totalNs;
+            total.maxNs = std::max(total.maxNs, stats.maxNs);
+        }
+        for (const auto& [name, value] : buffer->counters) {
+            counters[name] += value;
+        }
+    }
+
+    std::vector<std::pair<const char*, Stats>> sorted(timers.begin(), timers.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second.totalNs > rhs.second.totalNs;
+    });
+    os << std::left << std::setw(32) << "scope" << std::right << std::setw(12) << "calls"
+       << std::setw(14) << "total ms" << std::setw(12) << "mean us" << std::setw(12) << "max us" << '\n';
+    os << std::fixed << std::setprecision(2);
+    for (const auto& [name, stats] : sorted) {
+        os << std::left << std::setw(32) << name << std::right << std::setw(12) << stats.count
+           << std::setw(14) << stats.totalNs / 1e6 << std::setw(12) << stats.totalNs / 1e3 / stats.count
+           << std::setw(12) << stats.maxNs / 1e3 << '\n';
+    }
+    for (const auto& [name, value] : counters) {
+        os << std::left << std::setw(32) << name << std::right << std::setw(12) << value << '\n';
+    }
+}
+
+}  // namespace profiler
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+#ifdef CHECKERS_PROFILE
+#define PROFILE_SCOPE(name) ::profiler::ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNT(name, value) ::profiler::Count(name, value)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(name, value) ((void)0)
+#endif
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <span>
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"). The output is a
+// pure function of (seed, stream, position), so every thread, child or game can own a stream and
+// results do not depend on scheduling. Satisfies UniformRandomBitGenerator.
+class Philox {
+public:
+    using result_type = std::uint32_t;
+    using Block = std::array<std::uint32_t, 4>;
+
+    explicit Philox(std::uint64_t seed = 0, std::uint64_t stream = 0)
+        : key_{Low(seed), High(seed)}, counter_{0, 0, Low(stream), High(stream)} {
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()() {
+        if (index_ == block_.size()) {
+            block_ = NextBlock();
+            index_ = 0;
+        }
+        return block_[index_++];
+    }
+
+    Block NextBlock() {
+        auto block = Encrypt(counter_, key_);
+        if (++counter_[0] == 0) {
+            ++counter_[1];
+        }
+        return block;
+    }
+
+    // Uniform in [0, bound) without division.
+    std::uint32_t Below(std::uint32_t bound) {
+        return static_cast<std::uint32_t>((static_cast<std::uint64_t>((*this)()) * bound) >> 32);
+    }
+
+    // Uniform in (0, 1).
+    float Uniform() {
+        return (static_cast<float>((*this)() >> 8) + 0.5F) * 0x1p-24F;
+    }
+
+private:
+    static constexpr std::uint32_t M0 = 0xD2511F53;
+    static constexpr std::uint32_t M1 = 0xCD9E8D57;
+    static constexpr std::uint32_t W0 = 0x9E3779B9;
+    static constexpr std::uint32_t W1 = 0xBB67AE85;
+
+    static std::uint32_t Low(std::uint64_t x) {
+        return static_cast<std::uint32_t>(x);
+    }
+
+    static std::uint32_t High(std::uint64_t x) {
+        return static_cast<std::uint32_t>(x >> 32);
+    }
+
+    static Block Encrypt(Block c, std::array<std::uint32_t, 2> k) {
+        for (int round = 0; round < 10; ++round) {
+            auto p0 = static_cast<std::uint64_t>(M0) * c[0];
+            auto p1 = static_cast<std::uint64_t>(M1) * c[2];
+            c = {High(p1) ^ c[1] ^ k[0], Low(p1), High(p0) ^ c[3] ^ k[1], Low(p0)};
+            k[0] += W0;
+            k[1] += W1;
+        }
+        return c;
+    }
+
+    std::array<std::uint32_t, 2> key_;
+    Block counter_;
+    Block block_{};
+    size_t index_ = 4;
+};
+
+namespace simd {
+
+// Four lanes with GCC vector extensions (casts between them reinterpret the bits), SSE2/NEON
+// width, so no target flags are needed.
+using Float4 = float __attribute__((vector_size(16)));
+using Int4 = std::int32_t __attribute__((vector_size(16)));
+using Uint4 = std::uint32_t __attribute__((vector_size(16)));
+
+// Natural logarithm for positive normal inputs, the Cephes logf polynomial.
+inline Float4 Log(Float4 x) {
+    auto bits = (Int4)x;
+    Int4 exponent = ((bits >> 23) & 0xFF) - 126;
+    Int4 mantissaBits = (bits & 0x007FFFFF) | 0x3F000000;
+    auto m = (Float4)mantissaBits;  // [0.5, 1)
+
+    Int4 small = m < 0.707106781F;  // -1 where true
+    exponent += small;
+    m = small ? m + m - 1.0F : m - 1.0F;
+    Float4 e = __builtin_convertvector(exponent, Float4);
+
+    Float4 z = m * m;
+    Float4 p = m * 7.0376836292E-2F - 1.1514610310E-1F;
+    p = p * m + 1.1676998740E-1F;
+    p = p * m - 1.2420140846E-1F;
+    p = p * m + 1.4249322787E-1F;
+    p = p * m - 1.6668057665E-1F;
+    p = p * m + 2.0000714765E-1F;
+    p = p * m - 2.4999993993E-1F;
+    p = p * m + 3.3333331174E-1F;
+    Float4 y = p * m * z;
+    y += e * -2.12194440E-4F;
+    y -= 0.5F * z;
+    return m + y + e * 0.693359375F;
+}
+
+// Square root of positive inputs: the bit-trick estimate refined by three Newton steps.
+inline Float4 Sqrt(Float4 x) {
+    auto y = (Float4)(0x5F3759DF - ((Int4)x >> 1));
+    for (int i = 0; i < 3; ++i) {
+        y = y * (1.5F - 0.5F * x * y * y);
+    }
+    return x * y;
+}
+
+// sin and cos of 2 * pi * u - pi for u in [0, 1): Taylor series on the half angle, which stays in
+// [-pi / 2, pi / 2), and the double angle formulas.
+inline void SinCos(Float4 u, Float4& sin, Float4& cos) {
+    Float4 x = (u - 0.5F) * 3.14159265F;
+    Float4 x2 = x * x;
+    Float4 s = x2 * -2.5052108E-8F + 2.7557319E-6F;
+    s = s * x2 - 1.9841270E-4F;
+    s = s * x2 + 8.3333333E-3F;
+    s = s * x2 - 1.6666667E-1F;
+    s = (s * x2 + 1.0F) * x;
+    Float4 c = x2 * 2.0876757E-9F - 2.7557319E-7F;
+    c = c * x2 + 2.4801587E-5F;
+    c = c * x2 - 1.3888889E-3F;
+    c = c * x2 + 4.1666667E-2F;
+    c = c * x2 - 0.5F;
+    c = c * x2 + 1.0F;
+    sin = 2.0F * s * c;
+    cos = c * c - s * s;
+}
+
+// Uniform in (0, 1) from 32 random bits per lane.
+inline Float4 Uniform(const Philox::Block& block) {
+    Uint4 bits;
+    std::memcpy(&bits, block.data(), sizeof(bits));
+    return (__builtin_convertvector(bits >> 8, Float4) + 0.5F) * 0x1p-24F;
+}
+
+}  // namespace simd
+
+// Fills out with normal numbers, eight per Box-Muller step.
+inline void FillNormal(Philox& rng, std::span<float> out, float mean = 0, float sigma = 1) {
+    for (size_t i = 0; i < out.size(); i += 8) {
+        auto u1 = simd::Uniform(rng.NextBlock());
+        auto u2 = simd::Uniform(rng.NextBlock());
+        auto radius = simd::Sqrt(-2.0F * simd::Log(u1)) * sigma;
+        simd::Float4 sin;
+        simd::Float4 cos;
+        simd::SinCos(u2, sin, cos);
+
+        std::array<float, 8> normals;
+        auto first = radius * cos + mean;
+        auto second = radius * sin + mean;
+        std::memcpy(normals.data(), &first, sizeof(first));
+        std::memcpy(normals.data() + 4, &second, sizeof(second));
+        auto count = std::min<size_t>(8, out.size() - i);
+        std::memcpy(out.data() + i, normals.data(), count * sizeof(float));
+    }
+}
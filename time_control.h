@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// How much computer players may think: a clock of `base` per side that gains `increment` after
+// every move, a fixed time per move, a fixed number of nodes per move, or a mix. All zero is no
+// limit.
+struct TimeControl {
+    using Clock = std::chrono::steady_clock;
+    using Duration = std::chrono::milliseconds;
+
+    Duration base{0};
+    Duration increment{0};
+    Duration moveTime{0};
+    // Positions a player evaluates per move. Without a time limit as well, a single-threaded
+    // search plays the same moves on any machine and under any load.
+    std::uint64_t nodes = 0;
+
+    bool HasClock() const {
+        return base.count() > 0;
+    }
+
+    // "<base>[+<increment>]" in seconds, e.g. "60+0.5".
+    static TimeControl Parse(const std::string& text) {
+        auto seconds = [&](const std::string& part) {
+            size_t end = 0;
+            double value = -1;
+            try {
+                value = std::stod(part, &end);
+            } catch (const std::exception&) {
+            }
+            if (end != part.size() || value < 0) {
+                throw std::runtime_error("bad time control " + text);
+            }
+            return Duration(static_cast<Duration::rep>(value * 1000));
+        };
+        TimeControl control;
+        auto plus = text.find('+');
+        control.base = seconds(text.substr(0, plus));
+        if (plus != std::string::npos) {
+            control.increment = seconds(text.substr(plus + 1));
+        }
+        return control;
+    }
+};
+
+// What a player may spend on its next move. It aims to move by `target` and may think on until
+// `deadline` while its choice is unsettled. Default constructed, it is the player's own default.
+struct MoveLimits {
+    // Zero for no limit.
+    std::uint64_t nodes = 0;
+    TimeControl::Clock::time_point target = TimeControl::Clock::time_point::max();
+    TimeControl::Clock::time_point deadline = TimeControl::Clock::time_point::max();
+
+    bool Timed() const {
+        return deadline != TimeControl::Clock::time_point::max();
+    }
+};
+
+// Both sides' time. A side's clock runs from Start to Stop, which adds the increment. Without a
+// base in the control the clocks only measure the time used.
+class GameClock {
+public:
+    using Clock = TimeControl::Clock;
+    using Duration = TimeControl::Duration;
+
+    explicit GameClock(TimeControl control) : control_(control), remaining_{control.base, control.base} {
+    }
+
+    void Start(bool white) {
+        running_ = white ? WHITE : BLACK;
+        started_ = Clock::now();
+    }
+
+    // Returns false if the side ran out of time before its move.
+    bool Stop() {
+        if (running_ == NONE) {
+            return true;
+        }
+        auto side = running_;
+        auto elapsed = Clock::now() - started_;
+        running_ = NONE;
+        used_[side] += elapsed;
+        ++moves_[side];
+        remaining_[side] -= elapsed;
+        if (control_.HasClock() && remaining_[side].count() < 0) {
+            return false;
+        }
+        remaining_[side] += control_.increment;
+        return true;
+    }
+
+    bool Running() const {
+        return running_ != NONE;
+    }
+
+    // Counting the move being thought about.
+    Duration Remaining(bool white) const {
+        return std::chrono::duration_cast<Duration>(Left(white ? WHITE : BLACK));
+    }
+
+    bool Flagged(bool white) const {
+        return control_.HasClock() && Left(white ? WHITE : BLACK).count() < 0;
+    }
+
+    // Over the finished moves.
+    Clock::duration Used(bool white) const {
+        return used_[white ? WHITE : BLACK];
+    }
+
+    int Moves(bool white) const {
+        return moves_[white ? WHITE : BLACK];
+    }
+
+    const TimeControl& Control() const {
+        return control_;
+    }
+
+private:
+    enum Side { WHITE, BLACK, NONE };
+
+    Clock::duration Left(Side side) const {
+        auto left = remaining_[side];
+        if (running_ == side) {
+            left -= Clock::now() - started_;
+        }
+        return left;
+    }
+
+    TimeControl control_;
+    Clock::duration remaining_[2];
+    Clock::duration used_[2] = {};
+    int moves_[2] = {};
+    Side running_ = NONE;
+    Clock::time_point started_;
+};
+
+// The time management of computer players: the remaining time is spread over the moves expected
+// to come, the increment is spent as it arrives. The deadline leaves the player room to think
+// longer about a hard move, but never more than a fraction of what is left, so no single move
+// flags.
+//
+// `remaining` is the mover's clock and `ply` the number of moves played in the game so far.
+inline MoveLimits AllocateTime(const TimeControl& control, TimeControl::Duration remaining, int ply,
+                               TimeControl::Clock::time_point now = TimeControl::Clock::now()) {
+    // Moves per side in a typical game, and at least this many are assumed to remain.
+    static constexpr int GAME_MOVES = 35;
+    static constexpr int MIN_MOVES_TO_GO = 10;
+    // The deadline is at most this many targets, and at most this share of the remaining time.
+    static constexpr int MAX_STRETCH = 4;
+    static constexpr double MAX_SHARE = 0.5;
+    // Lost between the decision and the clock stopping.
+    static constexpr TimeControl::Duration OVERHEAD{10};
+
+    MoveLimits limits;
+    limits.nodes = control.nodes;
+    if (control.moveTime.count() > 0) {
+        limits.target = limits.deadline = now + control.moveTime;
+    }
+    if (control.HasClock()) {
+        auto movesToGo = std::max(MIN_MOVES_TO_GO, GAME_MOVES - ply / 2);
+        auto available = std::max(TimeControl::Duration(0), remaining - OVERHEAD);
+        auto target = available / movesToGo + control.increment * 3 / 4;
+        auto deadline = std::min(target * MAX_STRETCH,
+                                 std::chrono::duration_cast<TimeControl::Duration>(available * MAX_SHARE));
+        target = std::min(target, deadline);
+        limits.target = std::min(limits.target, now + target);
+        limits.deadline = std::min(limits.deadline, now + deadline);
+    }
+    return limits;
+}
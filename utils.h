@@ -1,6 +1,10 @@
 #include <SFML/Graphics.hpp>
 
+#include <array>
+#include <cstdint>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 
 namespace color {
@@ -24,7 +28,48 @@ static const auto AVAILABLE_MOVE = SOFT_SEA_FOAM;
 
 static constexpr float PIECE_RADIUS = 30;
 static constexpr float CELL_SIZE = 80;
-static const auto UNDEFINED_POSITION = sf::Vector2f{-100, -100};
+
+static constexpr int INPUT_DIM = 5;
+static constexpr int INPUT_ROWS = 32;
+
+// Content of a playable cell, the index of the one in a one-hot network input row.
+enum CellCode : std::uint8_t {
+    CELL_FREE = 0,
+    CELL_WHITE = 1,
+    CELL_WHITE_QUEEN = 2,
+    CELL_BLACK = 3,
+    CELL_BLACK_QUEEN = 4,
+};
+
+using BoardCodes = std::array<std::uint8_t, INPUT_ROWS>;
+
+// The checkered board of CELL_SIZE squares, built in memory once per size, so it needs neither a
+// window nor a file. Thread-safe.
+const sf::Image& BoardImage(int rows, int cols) {
+    static std::mutex mutex;
+    static std::map<std::pair<int, int>, sf::Image> cache;
+    std::unique_lock lock(mutex);
+    auto [it, inserted] = cache.try_emplace({rows, cols});
+    if (!inserted) {
+        return it->second;
+    }
+
+    const auto cellSize = static_cast<int>(CELL_SIZE);
+    const auto width = cols * cellSize;
+    std::vector<sf::Uint8> pixels(4 * width * rows * cellSize);
+    for (int y = 0; y < rows * cellSize; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const auto& c = ((y / cellSize + x / cellSize) & 1) ? color::LIGHT_GREY : color::PEACH_PUFF;
+            auto* pixel = &pixels[4 * (y * width + x)];
+            pixel[0] = c.r;
+            pixel[1] = c.g;
+            pixel[2] = c.b;
+            pixel[3] = c.a;
+        }
+    }
+    it->second.create(width, rows * cellSize, pixels.data());
+    return it->second;
+}
 
 template <class C>
 class Enumerate {
@@ -56,14 +101,53 @@ private:
 
 #pragma once
 
+#include "profiler.h"
+
+#include <atomic>
 #include <condition_variable>
 #include <deque>
 #include <functional>
 #include <mutex>
+#include <optional>
 #include <thread>
 #include <utility>
 #include <vector>
 
+// Lock-free ring buffer for exactly one producer and one consumer thread.
+template <class T, size_t Capacity>
+class SpscQueue {
+public:
+    // Returns false if the queue is full.
+    bool Push(T value) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto next = (tail + 1) % SIZE;
+        if (next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        buffer_[tail] = std::move(value);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    std::optional<T> Pop() {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return std::nullopt;
+        }
+        std::optional<T> value(std::move(buffer_[head]));
+        head_.store((head + 1) % SIZE, std::memory_order_release);
+        return value;
+    }
+
+private:
+    // One slot always stays empty to tell a full queue from an empty one.
+    static constexpr size_t SIZE = Capacity + 1;
+
+    std::array<T, SIZE> buffer_;
+    alignas(64) std::atomic<size_t> head_ = 0;
+    alignas(64) std::atomic<size_t> tail_ = 0;
+};
+
 class Task {
 public:
     explicit Task(std::function<void()> function) : function_(std::move(function)) {
@@ -211,7 +295,10 @@ void ThreadPool::PollTasks() {
             ++inProcess_;
 
             lock.unlock();
-            (*task)();
+            {
+                PROFILE_SCOPE("ThreadPool::Task");
+                (*task)();
+            }
             lock.lock();
 
             --inProcess_;
@@ -288,3 +375,9 @@ Logger& Log() {
     thread_local Logger logger;
     return logger;
 }
+
+// Swallows everything written to it, for logs of headless games nobody is going to replay.
+std::ostream& NullStream() {
+    thread_local std::ostream stream(nullptr);
+    return stream;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <random>
+#include <span>
+#include <vector>
+
+// The BuildNeuralNetwork shape (one-hot INPUT_ROWS x INPUT_DIM -> 32 -> ReLU -> 16 -> ReLU -> 1)
+// with all parameters in one flat array, so it can be trained by gradients and mutated in place.
+// The output is the expected result from the whites' point of view.
+class ValueNet {
+public:
+    static constexpr size_t INPUT = INPUT_ROWS * INPUT_DIM;
+    static constexpr size_t HIDDEN1 = 32;
+    static constexpr size_t HIDDEN2 = 16;
+
+    // Offsets into the parameter array. Weights are stored input-major so that every input
+    // contributes one contiguous row to the layer output.
+    static constexpr size_t W1 = 0;
+    static constexpr size_t B1 = W1 + INPUT * HIDDEN1;
+    static constexpr size_t W2 = B1 + HIDDEN1;
+    static constexpr size_t B2 = W2 + HIDDEN1 * HIDDEN2;
+    static constexpr size_t W3 = B2 + HIDDEN2;
+    static constexpr size_t B3 = W3 + HIDDEN2;
+    static constexpr size_t NUM_PARAMS = B3 + 1;
+
+    using Gradients = std::vector<float>;
+
+    struct Activations {
+        std::array<float, HIDDEN1> h1;
+        std::array<float, HIDDEN2> h2;
+        float out;
+    };
+
+    explicit ValueNet(std::uint64_t seed = 0) : params_(NUM_PARAMS, 0) {
+        std::mt19937_64 rng(seed);
+        auto init = [&](size_t offset, size_t fanIn, size_t size) {
+            std::normal_distribution<float> dist(0, std::sqrt(2.0F / fanIn));
+            for (size_t i = 0; i < size; ++i) {
+                params_[offset + i] = dist(rng);
+            }
+        };
+        // Only INPUT_ROWS inputs are hot at a time.
+        init(W1, INPUT_ROWS, INPUT * HIDDEN1);
+        init(W2, HIDDEN1, HIDDEN1 * HIDDEN2);
+        init(W3, HIDDEN2, HIDDEN2);
+    }
+
+    float Forward(const BoardCodes& codes) const {
+        Activations activations;
+        return Forward(codes, activations);
+    }
+
+    float Forward(const BoardCodes& codes, Activations& a) const {
+        const float* p = params_.data();
+        std::copy_n(p + B1, HIDDEN1, a.h1.begin());
+        for (size_t row = 0; row < codes.size(); ++row) {
+            const float* w = p + W1 + (row * INPUT_DIM + codes[row]) * HIDDEN1;
+            for (size_t j = 0; j < HIDDEN1; ++j) {
+                a.h1[j] += w[j];
+            }
+        }
+        for (auto& x : a.h1) {
+            x = std::max(x, 0.0F);
+        }
+
+        std::copy_n(p + B2, HIDDEN2, a.h2.begin());
+        for (size_t i = 0; i < HIDDEN1; ++i) {
+            const float* w = p + W2 + i * HIDDEN2;
+            for (size_t j = 0; j < HIDDEN2; ++j) {
+                a.h2[j] += a.h1[i] * w[j];
+            }
+        }
+        for (auto& x : a.h2) {
+            x = std::max(x, 0.0F);
+        }
+
+        a.out = p[B3];
+        for (size_t i = 0; i < HIDDEN2; ++i) {
+            a.out += a.h2[i] * p[W3 + i];
+        }
+        return a.out;
+    }
+
+    // Accumulates d(out)/d(params) * gradOut into grads.
+    void Backward(const BoardCodes& codes, const Activations& a, float gradOut, Gradients& grads) const {
+        const float* p = params_.data();
+        float* g = grads.data();
+
+        std::array<float, HIDDEN2> d2;
+        g[B3] += gradOut;
+        for (size_t i = 0; i < HIDDEN2; ++i) {
+            g[W3 + i] += gradOut * a.h2[i];
+            d2[i] = a.h2[i] > 0 ? gradOut * p[W3 + i] : 0;
+            g[B2 + i] += d2[i];
+        }
+
+        std::array<float, HIDDEN1> d1;
+        for (size_t i = 0; i < HIDDEN1; ++i) {
+            const float* w = p + W2 + i * HIDDEN2;
+            float* gw = g + W2 + i * HIDDEN2;
+            float sum = 0;
+            for (size_t j = 0; j < HIDDEN2; ++j) {
+                gw[j] += a.h1[i] * d2[j];
+                sum += w[j] * d2[j];
+            }
+            d1[i] = a.h1[i] > 0 ? sum : 0;
+            g[B1 + i] += d1[i];
+        }
+
+        for (size_t row = 0; row < codes.size(); ++row) {
+            float* gw = g + W1 + (row * INPUT_DIM + codes[row]) * HIDDEN1;
+            for (size_t j = 0; j < HIDDEN1; ++j) {
+                gw[j] += d1[j];
+            }
+        }
+    }
+
+    void Step(const Gradients& grads, float learningRate) {
+        for (size_t i = 0; i < NUM_PARAMS; ++i) {
+            params_[i] -= learningRate * grads[i];
+        }
+    }
+
+    std::span<float> Params() {
+        return params_;
+    }
+
+    std::span<const float> Params() const {
+        return params_;
+    }
+
+    void Dump(std::ostream& os) const {
+        os.write(reinterpret_cast<const char*>(params_.data()), NUM_PARAMS * sizeof(float));
+    }
+
+    void Load(std::istream& is) {
+        is.read(reinterpret_cast<char*>(params_.data()), NUM_PARAMS * sizeof(float));
+        if (!is) {
+            throw std::runtime_error("cannot load ValueNet");
+        }
+    }
+
+private:
+    std::vector<float> params_;
+};